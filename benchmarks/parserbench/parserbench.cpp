@@ -0,0 +1,159 @@
+// Feeds synthetic workloads through a headless TerminalEmulator and reports
+// how many bytes per second the escape parser and screen update sustain.
+//
+// usage: parserbench [megabytes per workload] [workload]
+
+#include "Hexe/Terminal/TerminalEmulator.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace Hexe::Terminal;
+
+static constexpr int COLUMNS = 160;
+static constexpr int ROWS = 50;
+
+struct Random
+{
+    uint32_t state = 0x12345678;
+
+    uint32_t Next(uint32_t range)
+    {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) % range;
+    }
+};
+
+static const char *const s_words[] = {
+    "int", "return", "while", "terminal", "escape", "sequence", "0x1f",
+    "const", "std::string", "main.cpp:42:", "error:", "warning:", "->",
+};
+
+static void AppendWords(std::string &out, Random &rng, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        out += s_words[rng.Next(sizeof(s_words) / sizeof(s_words[0]))];
+        out += ' ';
+    }
+}
+
+/* plain text, as from cat of a source file */
+static void GenerateText(std::string &out, Random &rng)
+{
+    AppendWords(out, rng, 1 + rng.Next(16));
+    out += "\r\n";
+}
+
+/* short colored spans, as from ls --color or compiler diagnostics */
+static void GenerateSgr(std::string &out, Random &rng)
+{
+    char buf[32];
+    for (int i = 0, n = 1 + rng.Next(8); i < n; i++)
+    {
+        snprintf(buf, sizeof(buf), "\033[%u;%um", rng.Next(2), 30 + rng.Next(8));
+        out += buf;
+        AppendWords(out, rng, 1 + rng.Next(3));
+        out += "\033[0m";
+    }
+    out += "\r\n";
+}
+
+/* full screen redraws with absolute positioning, as from an editor */
+static void GenerateCursor(std::string &out, Random &rng)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "\033[%u;%uH\033[K\033[38;5;%um",
+             1 + rng.Next(ROWS), 1 + rng.Next(COLUMNS / 2), rng.Next(256));
+    out += buf;
+    AppendWords(out, rng, 1 + rng.Next(4));
+    snprintf(buf, sizeof(buf), "\033[?25l\033[%uC\033[%uA\033[?25h", rng.Next(8), rng.Next(4));
+    out += buf;
+}
+
+/* truecolor with both ; and : separated parameters */
+static void GenerateTruecolor(std::string &out, Random &rng)
+{
+    char buf[64];
+    for (int i = 0, n = 1 + rng.Next(6); i < n; i++)
+    {
+        if (rng.Next(2))
+            snprintf(buf, sizeof(buf), "\033[38;2;%u;%u;%um", rng.Next(256), rng.Next(256), rng.Next(256));
+        else
+            snprintf(buf, sizeof(buf), "\033[48:2::%u:%u:%um", rng.Next(256), rng.Next(256), rng.Next(256));
+        out += buf;
+        AppendWords(out, rng, 1 + rng.Next(2));
+    }
+    out += "\033[m\r\n";
+}
+
+/* multibyte UTF-8 mixed with ASCII */
+static void GenerateUtf8(std::string &out, Random &rng)
+{
+    static const char *const s_runes[] = {"\xc3\xa6", "\xc3\xb8", "\xc3\xa5", "\xe2\x94\x80", "\xe2\x94\x82",
+                                          "\xe6\x97\xa5", "\xe6\x9c\xac", "\xf0\x9f\x98\x80"};
+    for (int i = 0, n = 1 + rng.Next(24); i < n; i++)
+    {
+        out += s_runes[rng.Next(sizeof(s_runes) / sizeof(s_runes[0]))];
+        if (rng.Next(4) == 0)
+            out += ' ';
+    }
+    out += "\r\n";
+}
+
+struct Workload
+{
+    const char *name;
+    void (*generate)(std::string &, Random &);
+};
+
+static const Workload s_workloads[] = {
+    {"text", GenerateText},
+    {"sgr", GenerateSgr},
+    {"cursor", GenerateCursor},
+    {"truecolor", GenerateTruecolor},
+    {"utf8", GenerateUtf8},
+};
+
+static void Run(const Workload &workload, size_t bytes)
+{
+    Random rng;
+    std::string data;
+    data.reserve(bytes + 4096);
+    while (data.size() < bytes)
+        workload.generate(data, rng);
+
+    /* warm up the caches and the allocator on a terminal of its own, which may stop in the middle of a sequence */
+    TerminalEmulator::Create(COLUMNS, ROWS)->Feed(data.data(), data.size() / 16);
+
+    auto terminal = TerminalEmulator::Create(COLUMNS, ROWS);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t offset = 0; offset < data.size(); offset += 4096)
+        terminal->Feed(data.data() + offset, std::min<size_t>(4096, data.size() - offset));
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    printf("%-10s %8.1f MB/s\n", workload.name, data.size() / elapsed.count() / (1024.0 * 1024.0));
+}
+
+int main(int argc, char **argv)
+{
+    size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 64;
+    const char *only = argc > 2 ? argv[2] : nullptr;
+
+    if (megabytes == 0)
+    {
+        fprintf(stderr, "usage: %s [megabytes] [workload]\n", argv[0]);
+        return 1;
+    }
+
+    for (const auto &workload : s_workloads)
+    {
+        if (!only || strcmp(only, workload.name) == 0)
+            Run(workload, megabytes * 1024 * 1024);
+    }
+    return 0;
+}
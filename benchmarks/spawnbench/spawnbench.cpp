@@ -0,0 +1,97 @@
+// Starts shells on pseudoterminals one after the other, the way new tabs are
+// opened, and reports how long starting one takes and how long until it has
+// run and exited. The benchmark first touches a resident set of the given
+// size, as a GUI process with its fonts and textures has, and raises its
+// descriptor limit to the hard limit, as some hosts do.
+//
+// usage: spawnbench [count] [resident megabytes] [program]
+
+#include "Hexe/System/ProcessFactory.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+
+using namespace Hexe::System;
+
+using Clock = std::chrono::steady_clock;
+
+static double Milliseconds(Clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+int main(int argc, char **argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 1000;
+    size_t resident = argc > 2 ? strtoul(argv[2], nullptr, 10) : 256;
+    std::string program = argc > 3 ? argv[3] : "/bin/sh";
+
+    if (count <= 0)
+    {
+        fprintf(stderr, "usage: %s [count] [resident megabytes] [program]\n", argv[0]);
+        return 1;
+    }
+
+#ifndef WIN32
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+        printf("descriptor limit %llu\n", (unsigned long long)rl.rlim_cur);
+    }
+#endif
+
+    /* every page is written, so a fork() would have to copy its mapping */
+    std::vector<char> heap(resident * 1024 * 1024);
+    for (size_t i = 0; i < heap.size(); i += 4096)
+        heap[i] = (char)i;
+
+    ProcessFactory factory;
+    std::vector<double> spawns;
+    double total = 0.0;
+    int failed = 0;
+
+    auto start = Clock::now();
+    for (int i = 0; i < count; i++)
+    {
+        std::unique_ptr<Hexe::Terminal::IPseudoTerminal> pty;
+
+        auto before = Clock::now();
+        auto process = factory.CreateWithPseudoTerminal(program, {"-c", "exit 0"}, "", 80, 24, pty);
+        auto spawned = Clock::now();
+        if (!process)
+        {
+            failed++;
+            continue;
+        }
+        process->WaitForExit();
+        if (process->GetExitCode() != 0)
+            failed++;
+
+        spawns.push_back(Milliseconds(spawned - before));
+        total += Milliseconds(Clock::now() - before);
+    }
+    double elapsed = Milliseconds(Clock::now() - start);
+
+    if (spawns.empty())
+    {
+        fprintf(stderr, "couldn't start %s\n", program.c_str());
+        return 1;
+    }
+
+    std::sort(spawns.begin(), spawns.end());
+    printf("%d shells with %zu MB resident in %.0f ms, %d failed\n", count, resident, elapsed, failed);
+    printf("start    median %7.3f ms   p99 %7.3f ms   max %7.3f ms\n",
+           spawns[spawns.size() / 2], spawns[spawns.size() * 99 / 100], spawns.back());
+    printf("to exit  mean   %7.3f ms\n", total / spawns.size());
+    return failed ? 1 : 0;
+}
@@ -7,6 +7,10 @@
 #include "imgui_impl_sdl.h"
 #include "imgui_impl_opengl3.h"
 #include "Hexe/Terminal/ImGuiTerminal.h"
+#include "Hexe/Terminal/TerminalReactor.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #undef max
 #undef min
@@ -210,15 +214,55 @@ int main(int argc, char *argv[])
 
     std::string title = "Terminal";
 
+    // The reactor tells when the terminal has output, so the loop can sleep until there is either output or an
+    // event. SDL can't wait on descriptors, so a thread waits on the reactor and posts an event, and then waits
+    // for the loop to dispatch before it looks again. Without a reactor the terminal parses on a thread of its own
+    // and the loop polls for its frames.
+    auto reactor = Hexe::Terminal::TerminalReactor::Create();
+    Uint32 reactorEvent = SDL_RegisterEvents(1);
+    std::mutex watchLock;
+    std::condition_variable watchArmed;
+    bool watching = true;
+    bool watchStop = false;
+    std::thread watcher;
+    if (reactor)
+    {
+        watcher = std::thread([&] {
+            std::unique_lock<std::mutex> lk(watchLock);
+            for (;;)
+            {
+                watchArmed.wait(lk, [&] { return watching || watchStop; });
+                if (watchStop)
+                    break;
+                lk.unlock();
+                reactor->Wait();
+                lk.lock();
+                if (watchStop)
+                    break;
+                SDL_Event wakeup{};
+                wakeup.type = reactorEvent;
+                SDL_PushEvent(&wakeup);
+                watching = false;
+            }
+        });
+    }
+
     std::shared_ptr<Hexe::Terminal::ImGuiTerminal> terminal = nullptr;
+    bool registered = false;
 
     ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
+    int settleFrames = 0;
 
     while (!exitRequested)
     {
         SDL_Event event;
-        if (SDL_WaitEventTimeout(&event, 4))
+        bool events = false;
+        bool fresh = false;
+        // The cursor blinks every 0.7 seconds, so even an idle loop comes around a few times per second. Nothing
+        // wakes it when the shell is up, so it polls until then.
+        if (SDL_WaitEventTimeout(&event, reactor && !(terminal && terminal->IsSpawning()) ? 100 : 4))
         {
+            events = true;
             do
             {
                 ImGui_ImplSDL2_ProcessEvent(&event);
@@ -233,6 +277,34 @@ int main(int argc, char *argv[])
             } while (SDL_PollEvent(&event));
         }
 
+        if (reactor)
+        {
+            reactor->Dispatch();
+            std::lock_guard<std::mutex> lk(watchLock);
+            watching = true;
+            watchArmed.notify_one();
+        }
+
+        if (terminal)
+        {
+            fresh = terminal->Update();
+            // The shell is started on a helper thread, the terminal has a pseudoterminal to wait on once it is up
+            if (reactor && !registered && !terminal->IsSpawning() && !terminal->HasTerminated())
+                registered = reactor->Add(*terminal->GetTerminalEmulator());
+            if (terminal->GetTitle() != title)
+            {
+                title = terminal->GetTitle();
+                SDL_SetWindowTitle(window, title.empty() ? "Terminal" : title.c_str());
+            }
+        }
+
+        // Render a few frames after input for ImGui to settle, after that only when the terminal drew something new
+        if (events || fresh || !terminal || terminal->HasTerminated() || showDemoWindow)
+            settleFrames = 3;
+        if (settleFrames == 0)
+            continue;
+        settleFrames--;
+
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplSDL2_NewFrame(window);
         ImGui::NewFrame();
@@ -254,16 +326,6 @@ int main(int argc, char *argv[])
             ImGui::EndMainMenuBar();
         }
 
-        if (terminal)
-        {
-            terminal->Update();
-            if (terminal->GetTitle() != title)
-            {
-                title = terminal->GetTitle();
-                SDL_SetWindowTitle(window, title.empty() ? "Terminal" : title.c_str());
-            }
-        }
-
         if (showDemoWindow)
         {
             ImGui::ShowDemoWindow(&showDemoWindow);
@@ -295,7 +357,7 @@ int main(int argc, char *argv[])
                     auto columns = (int)std::floor(std::max(1.0f, contentRegion.x / charWidth));
                     auto rows = (int)std::floor(std::max(1.0f, contentRegion.y / charHeight));
 
-                    terminal = Hexe::Terminal::ImGuiTerminal::Create(columns, rows, options.program, options.arguments, "", emojiFontData.empty() ? 0 : Hexe::Terminal::ImGuiTerminalOptions::OPTION_COLOR_EMOJI | Hexe::Terminal::ImGuiTerminalOptions::OPTION_PASTE_CRLF);
+                    terminal = Hexe::Terminal::ImGuiTerminal::CreateAsync(columns, rows, options.program, options.arguments, "", (emojiFontData.empty() ? 0 : Hexe::Terminal::ImGuiTerminalOptions::OPTION_COLOR_EMOJI | Hexe::Terminal::ImGuiTerminalOptions::OPTION_PASTE_CRLF) | (reactor ? 0 : Hexe::Terminal::ImGuiTerminalOptions::OPTION_PARSER_THREAD));
                     terminal->SetFont(fontDefault, fontBold, fontItalic, fontBoldItalic);
                 }
                 if (!terminal || terminal->HasTerminated())
@@ -332,6 +394,17 @@ int main(int argc, char *argv[])
         SDL_Delay(1);
     }
 
+    if (watcher.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lk(watchLock);
+            watchStop = true;
+        }
+        watchArmed.notify_one();
+        reactor->Wakeup();
+        watcher.join();
+    }
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
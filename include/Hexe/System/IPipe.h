@@ -40,8 +40,24 @@ namespace Hexe
 
       virtual bool IsTTY() const = 0;
 
+      // Returns the nb of bytes written, fewer than n when the pipe can't take more without blocking,
+      // or -1 on error
       virtual int Write(const char *s, size_t n) = 0;
       virtual int Read(char *buf, size_t n, bool block = false) = 0;
+
+      // Makes a blocking Read() in another thread return 0, and every Read() after it return 0 right away.
+      // Pipes that can't be interrupted ignore it.
+      virtual void Interrupt() {}
+
+      // A file descriptor that polls readable when Read() has something to return, -1 if there is none
+      virtual int GetPollFd() const { return -1; }
+
+      // Nb of bytes Read() could return right now without blocking, 0 if the pipe can't tell
+      virtual size_t GetPending() const { return 0; }
+
+      // Copies everything Read() returns to fd as well, a log file for instance, from then on. The descriptor is
+      // duplicated. Returns false for pipes that can't.
+      virtual bool Tee(int /*fd*/) { return false; }
     };
   } // namespace System
 } // namespace Hexe
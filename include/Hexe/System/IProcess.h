@@ -44,6 +44,9 @@ namespace Hexe
             virtual void CheckExitStatus() = 0;
             virtual bool HasExited() const = 0;
             virtual int GetExitCode() const = 0;
+            // A descriptor that polls readable once the process has exited, so CheckExitStatus() only has to be
+            // called then, or -1 when the exit can only be found by calling it
+            virtual int GetPollFd() const { return -1; }
 
             virtual void Terminate() = 0;
             virtual void WaitForExit() = 0;
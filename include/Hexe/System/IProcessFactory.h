@@ -24,6 +24,7 @@
 #include "IProcess.h"
 #include "../Terminal/IPseudoTerminal.h"
 
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
@@ -32,6 +33,12 @@ namespace Hexe
 {
     namespace System
     {
+        struct PseudoTerminalProcess
+        {
+            std::unique_ptr<IProcess> process;
+            std::unique_ptr<Hexe::Terminal::IPseudoTerminal> pseudoTerminal;
+        };
+
         class IProcessFactory
         {
         public:
@@ -55,6 +62,24 @@ namespace Hexe
                                      const std::string &workingDirectory,
                                      int numColumns, int numRows,
                                      std::unique_ptr<Hexe::Terminal::IPseudoTerminal> &outPseudoTerminal) = 0;
+
+            // Does the same on a helper thread, so opening the pseudoterminal and starting the process don't hold up
+            // the caller. Both are null in the result when either failed. The factory has to outlive the future, and
+            // destroying the future before the process was started waits for it.
+            virtual std::future<PseudoTerminalProcess>
+            CreateWithPseudoTerminalAsync(const std::string &program,
+                                          const std::vector<std::string> &args,
+                                          const std::string &workingDirectory,
+                                          int numColumns, int numRows)
+            {
+                return std::async(std::launch::async, [=] {
+                    PseudoTerminalProcess result;
+                    result.process = CreateWithPseudoTerminal(program, args, workingDirectory, numColumns, numRows, result.pseudoTerminal);
+                    if (!result.process)
+                        result.pseudoTerminal = nullptr;
+                    return result;
+                });
+            }
         };
 
     } // namespace System
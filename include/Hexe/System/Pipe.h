@@ -40,9 +40,16 @@ namespace Hexe
 
             Pipe(AutoHandle &&readHandle, AutoHandle &&writeHandle);
 #else
-            AutoHandle m_handle;
+            AutoHandle m_hInput;    /* the child's stdout */
+            AutoHandle m_hOutput;   /* the child's stdin */
+            AutoHandle m_wakeRead;  /* becomes readable when Interrupt() is called */
+            AutoHandle m_wakeWrite;
+            AutoHandle m_log;       /* Tee() target */
+            AutoHandle m_logRead;   /* the output is tee()d into this pipe on its way to m_log */
+            AutoHandle m_logWrite;
 
-            Pipe(AutoHandle &&handle);
+            Pipe(AutoHandle &&readHandle, AutoHandle &&writeHandle, AutoHandle &&wakeRead, AutoHandle &&wakeWrite);
+            bool LogSpliced(size_t n);
 #endif
         public:
             Pipe(Pipe &&) = delete;
@@ -55,6 +62,12 @@ namespace Hexe
 
             virtual int Write(const char *s, size_t n) override;
             virtual int Read(char *buf, size_t n, bool block = false) override;
+#ifndef WIN32
+            virtual void Interrupt() override;
+            virtual int GetPollFd() const override;
+            virtual size_t GetPending() const override;
+            virtual bool Tee(int fd) override;
+#endif
 
             static bool CreatePipePair(std::unique_ptr<Pipe> &outPipeA, std::unique_ptr<Pipe> &outPipeB);
         };
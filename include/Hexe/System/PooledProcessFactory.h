@@ -0,0 +1,110 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+#pragma once
+
+#include "IProcessFactory.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace Hexe
+{
+    namespace System
+    {
+        // Keeps shells started ahead of time, so a new session gets one that is already at its prompt. Requests for
+        // the pooled program, arguments and working directory are served from the pool, with the pseudoterminal
+        // resized to the requested size, everything else goes to the wrapped factory. A helper thread keeps as many
+        // shells warm as were asked for over the last minute, between minWarm and maxWarm. Warm shells inherit the
+        // environment they were started with, and a shell that exits while it waits is replaced.
+        class PooledProcessFactory final : public IProcessFactory
+        {
+        private:
+            using Clock = std::chrono::steady_clock;
+
+            std::unique_ptr<IProcessFactory> m_factory;
+            std::string m_program;
+            std::vector<std::string> m_args;
+            std::string m_workingDirectory;
+            int m_numColumns;
+            int m_numRows;
+            size_t m_minWarm;
+            size_t m_maxWarm;
+
+            std::mutex m_lock;
+            std::condition_variable m_wake; /* a shell was handed out, or the pool stops */
+            std::deque<PseudoTerminalProcess> m_warm;
+            std::deque<Clock::time_point> m_demand; /* when pooled shells were asked for, over the last minute */
+            size_t m_hits;
+            size_t m_misses;
+            bool m_stop;
+            std::thread m_thread;
+
+            bool Pooled(const std::string &program, const std::vector<std::string> &args, const std::string &workingDirectory) const;
+            bool Take(int numColumns, int numRows, PseudoTerminalProcess &out);
+            size_t Target(Clock::time_point now);
+            void Fill();
+
+        public:
+            // A null factory uses a ProcessFactory. Warm shells are started at numColumns x numRows.
+            PooledProcessFactory(std::unique_ptr<IProcessFactory> &&factory,
+                                 const std::string &program,
+                                 const std::vector<std::string> &args,
+                                 const std::string &workingDirectory,
+                                 size_t minWarm = 1, size_t maxWarm = 4,
+                                 int numColumns = 80, int numRows = 24);
+            virtual ~PooledProcessFactory();
+            PooledProcessFactory(const PooledProcessFactory &) = delete;
+            PooledProcessFactory(PooledProcessFactory &&) = delete;
+            PooledProcessFactory &operator=(const PooledProcessFactory &) = delete;
+            PooledProcessFactory &operator=(PooledProcessFactory &&) = delete;
+
+            virtual std::unique_ptr<IProcess>
+            CreateWithStdioPipe(const std::string &program,
+                                const std::vector<std::string> &args,
+                                const std::string &workingDirectory,
+                                std::unique_ptr<IPipe> &outPipe,
+                                bool withStderr = true) override;
+
+            virtual std::unique_ptr<IProcess>
+            CreateWithPseudoTerminal(const std::string &program,
+                                     const std::vector<std::string> &args,
+                                     const std::string &workingDirectory,
+                                     int numColumns, int numRows,
+                                     std::unique_ptr<Hexe::Terminal::IPseudoTerminal> &outPseudoTerminal) override;
+
+            // Completes right away when a warm shell is handed out
+            virtual std::future<PseudoTerminalProcess>
+            CreateWithPseudoTerminalAsync(const std::string &program,
+                                          const std::vector<std::string> &args,
+                                          const std::string &workingDirectory,
+                                          int numColumns, int numRows) override;
+
+            size_t GetNumWarm();
+            // Nb of pooled requests served by a warm shell, and by starting one on the spot
+            size_t GetHits();
+            size_t GetMisses();
+        };
+    } // namespace System
+} // namespace Hexe
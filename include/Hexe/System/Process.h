@@ -52,6 +52,7 @@ namespace Hexe
               LPPROC_THREAD_ATTRIBUTE_LIST lpAttributeList);
 #else
       int m_pid;
+      AutoHandle m_pidfd; /* pidfd_open() of m_pid, where the kernel has it */
 
       Process(int pid);
 #endif
@@ -66,6 +67,7 @@ namespace Hexe
       virtual void CheckExitStatus() override;
       virtual bool HasExited() const override;
       virtual int GetExitCode() const override;
+      virtual int GetPollFd() const override;
 
       virtual void Terminate() override;
       virtual void WaitForExit() override;
@@ -24,6 +24,8 @@
 #include "Hexe/Terminal/TerminalDisplay.h"
 #include "Hexe/Terminal/TerminalEmulator.h"
 #include "Hexe/System/IProcessFactory.h"
+#include <atomic>
+#include <future>
 #include <memory>
 #include <string>
 #include <utility>
@@ -35,7 +37,10 @@ namespace Hexe
     {
         enum class ShortcutAction
         {
-            PASTE
+            PASTE,
+            CANCEL_PASTE,
+            SCROLL_UP,
+            SCROLL_DOWN
         };
 
         enum ImGuiTerminalOptions
@@ -43,7 +48,11 @@ namespace Hexe
             OPTION_NONE = 0,
             OPTION_COLOR_EMOJI = 1 << 0,
             OPTION_NO_BOXDRAWING = 1 << 1,
-            OPTION_PASTE_CRLF = 1 << 2
+            OPTION_PASTE_CRLF = 1 << 2,
+            // Read the pseudoterminal on a thread of its own, see TerminalEmulator::StartReader()
+            OPTION_READER_THREAD = 1 << 3,
+            // Parse on a thread of its own as well, see TerminalEmulator::StartParser()
+            OPTION_PARSER_THREAD = 1 << 4
         };
 
         struct ImGuiTerminalConfig
@@ -54,6 +63,55 @@ namespace Hexe
         class ImGuiTerminal : public Hexe::Terminal::TerminalDisplay
         {
         private:
+            // Everything rendering needs, copied from the drawn state when a frame is finished. Frames are
+            // triple buffered: the thread drawing the emulator fills the back frame and swaps it with the
+            // pending one, and rendering swaps the pending one with the front frame when it is newer. Neither
+            // side waits for the other.
+            struct Frame
+            {
+                ImVector<Hexe::Terminal::Glyph> buffer;
+                ImVector<unsigned> rowVersions;
+                unsigned layout; /* 0 until the first frame is published */
+                int columns;
+                int rows;
+                int cursorx;
+                int cursory;
+                Hexe::Terminal::Glyph cursorg;
+                bool cursorSelected;
+                int mode;
+                cursor_mode cursorMode;
+                uint32_t defaultfg;
+                uint32_t defaultbg;
+                uint32_t defaultcs;
+                uint32_t defaultrcs;
+                ImVector<ImU32> colors;
+                unsigned colorsVersion;
+                std::string title;
+                unsigned titleVersion;
+                std::string clipboard;
+                unsigned clipboardVersion;
+                uint64_t serial; /* changes with every published frame */
+            };
+
+            static constexpr int FRAME_INDEX = 3;
+            static constexpr int FRAME_FRESH = 4;
+            static constexpr size_t PASTE_CHUNK = 64 << 10; /* bytes of a paste written per update at most */
+
+            Frame m_frames[3];
+            int m_back;
+            int m_front;
+            std::atomic<int> m_pending; /* index of the pending frame, FRAME_FRESH when it wasn't rendered yet */
+
+            /* versions of the drawn state, a frame copies what differs from its own */
+            ImVector<unsigned> m_rowVersions;
+            unsigned m_layout;
+            unsigned m_colorsVersion;
+            unsigned m_titleVersion;
+            unsigned m_clipboardVersion;
+            unsigned m_clipboardSeen;
+            std::string m_clipboard;
+            bool m_cursorSelected;
+
             float m_borderpx;
             float m_cursorthickness;
             int m_cursorx;
@@ -67,8 +125,10 @@ namespace Hexe
             bool m_useBoxDrawing;
             bool m_useColorEmoji;
             bool m_pasteNewlineFix;
-            double m_elapsedTime;
+            bool m_blink;        /* blinking text is hidden */
+            bool m_drawHasBlink; /* the last drawn frame had blinking text */
             double m_lastBlink;
+            uint64_t m_frameSerial;
 
             ImFont *m_defaultFont;
             ImFont *m_boldFont;
@@ -82,23 +142,57 @@ namespace Hexe
                 bool buttonDown[5];
             } m_mouseState;
 
+            /* what the last DrawImGui() generated and where, reused until any of it changes */
+            struct
+            {
+                uint64_t serial;
+                ImVec2 pos;
+                float scale;
+                ImVec4 clipRect;
+                bool blink;
+                ImFont *fonts[4];
+                ImTextureID texId;
+                ImVec2 whitePixel;
+                ImVector<ImDrawVert> vtx;
+                ImVector<ImDrawIdx> idx; /* relative to the first vertex */
+            } m_drawCache;
+
+            /* the paste being written, a chunk per update, from m_pastePos on */
+            std::string m_paste;
+            size_t m_pastePos;
+            bool m_pasteBracketed;
+            std::string m_pasteChunk;
+
             std::string m_title;
             ImVector<Hexe::Terminal::Glyph> m_buffer;
             ImVector<std::pair<ImU32, std::string>> m_colors;
             std::shared_ptr<Hexe::Terminal::TerminalEmulator> m_terminal;
             mutable std::string m_clipboardLast;
 
+            std::future<System::PseudoTerminalProcess> m_spawn; /* the process CreateAsync() is starting */
+            uint32_t m_spawnOptions;
+
         private:
-            void DrawImGui(ImDrawList *draw_list, ImVec2 pos, float scale, const ImVec4 &clip_rect);
+            static double Now();
+            void PublishFrame();
+            Frame &AcquireFrame();
+            void DrawImGui(const Frame &frame, ImDrawList *draw_list, ImVec2 pos, float scale, const ImVec4 &clip_rect);
             void Draw(ImDrawList *draw_list, ImVec2 pos, float scale, const ImVec4 &clip_rect, bool hasFocus);
             void ProcessInput(int mousecx, int mousecy);
             void MouseReport(int cx, int cy, int button, int state, int type);
             void Action(ShortcutAction action);
+            void PasteChunk();
+            void Spawned();
+            void StartThreads(uint32_t options);
 
             ImGuiTerminal(int columns, int rows, ImGuiTerminalConfig *config);
+            static std::shared_ptr<ImGuiTerminal> Allocate(int columns, int rows, ImGuiTerminalConfig *config);
 
         public:
             bool HasTerminated() const;
+            // Whether the process of a terminal from CreateAsync() is still being started
+            inline bool IsSpawning() const { return m_spawn.valid(); }
+            inline Hexe::Terminal::TerminalEmulator *GetTerminalEmulator() const { return m_terminal.get(); }
 
             virtual void ResetColors() override;
             virtual int ResetColor(int index, const char *name) override;
@@ -109,6 +203,14 @@ namespace Hexe
             virtual void SetClipboard(const char *text);
             virtual const char *GetClipboard() const;
 
+            // Pastes text as input, in bounded chunks written over as many updates as the child takes to read
+            // them. The paste is wrapped in bracketed paste markers when the terminal asked for them, and ESC
+            // is taken out of it then, so it can't end the paste early. A new paste cancels the one going on.
+            // Like other input, it must be called with the emulator's lock held when it parses on a thread.
+            void Paste(const char *text, size_t len);
+            void CancelPaste();
+            inline bool IsPasting() const { return m_pastePos < m_paste.size(); }
+
             virtual void SetFont(ImFont *regular, ImFont *bold = nullptr, ImFont *italic = nullptr, ImFont *boldItalic = nullptr);
             inline ImFont *GetFont() const { return m_defaultFont; }
             inline ImFont *GetFontBold() const { return m_boldFont; }
@@ -119,12 +221,19 @@ namespace Hexe
             virtual void DrawLine(Hexe::Terminal::Line line, int x1, int y, int x2) override;
             virtual void DrawCursor(int cx, int cy, Hexe::Terminal::Glyph g, int ox, int oy, Hexe::Terminal::Glyph og) override;
             virtual void DrawEnd() override;
+            virtual bool WantsFrame() const override;
 
-            virtual void Update();
+            // Updates the emulator and picks up the frame it drew. Returns whether there is anything new to render,
+            // the host can skip rendering and presenting when no terminal and no input needs it.
+            virtual bool Update();
             void Draw(const ImVec4 &contentArea, float scale = 1.0f);
 
             static std::shared_ptr<ImGuiTerminal> Create(std::shared_ptr<Hexe::Terminal::TerminalEmulator> &&terminalEmulator, ImGuiTerminalConfig *config = 0);
             static std::shared_ptr<ImGuiTerminal> Create(int columns, int rows, const std::string &program, const ImVector<std::string> &args, const std::string &workingDir, uint32_t options = 0, System::IProcessFactory *processFactory = nullptr);
+            // Returns right away and starts the process on a helper thread instead. The terminal is blank and drops
+            // input until Update() finds the process started, and terminates if it couldn't be. Its emulator only has
+            // a pseudoterminal to add to a TerminalReactor or a ParserPool once IsSpawning() is false.
+            static std::shared_ptr<ImGuiTerminal> CreateAsync(int columns, int rows, const std::string &program, const ImVector<std::string> &args, const std::string &workingDir, uint32_t options = 0, System::IProcessFactory *processFactory = nullptr);
         };
     } // namespace Terminal
 } // namespace Hexe
\ No newline at end of file
@@ -0,0 +1,98 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+#pragma once
+
+#include "Hexe/AutoHandle.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Hexe
+{
+    namespace Terminal
+    {
+        class TerminalEmulator;
+
+        // Parses the output of many emulators on a few threads. A poller thread waits on all of their
+        // pseudoterminals and queues the ones with output on the workers, which read and parse a batch at a
+        // time, and take queued sessions from each other when they run out. A session is never queued twice,
+        // so its output is parsed in order by one worker at a time. Sessions keep parsing whether they are
+        // displayed or not.
+        //
+        // Like with TerminalEmulator::StartParser(), the display is drawn from the workers, and anything else
+        // that touches the screen must hold the emulator's GetLock(). The pool has to outlive the emulators
+        // added to it, and emulators with a reader thread or a TerminalReactor can't be added.
+        class ParserPool final
+        {
+        private:
+            struct Session;
+            struct Worker;
+
+            AutoHandle m_epoll;
+            AutoHandle m_wake; /* eventfd that stops the poller */
+            std::thread m_poller;
+            std::vector<std::unique_ptr<Worker>> m_workers;
+
+            std::mutex m_lock;
+            std::condition_variable m_work; /* a session was queued, or the pool stops */
+            std::condition_variable m_done; /* a session finished a batch */
+            std::unordered_map<uint64_t, std::unique_ptr<Session>> m_sessions;
+            uint64_t m_nextId;
+            size_t m_nextWorker;
+            std::atomic<size_t> m_queued;
+            std::atomic<bool> m_stop;
+
+            ParserPool(AutoHandle &&epoll, AutoHandle &&wake, int threads);
+
+            void Poll();
+            void Work(size_t self);
+            void Push(size_t worker, Session *s);
+            Session *Pop(size_t self);
+            void Run(size_t self, Session *s);
+
+        public:
+            ~ParserPool();
+            ParserPool(const ParserPool &) = delete;
+            ParserPool(ParserPool &&) = delete;
+            ParserPool &operator=(const ParserPool &) = delete;
+            ParserPool &operator=(ParserPool &&) = delete;
+
+            bool Add(TerminalEmulator &terminal);
+            // Waits for a batch of the emulator that is being parsed to finish, so it can't be called
+            // from a worker for the emulator that worker parses
+            void Remove(TerminalEmulator &terminal);
+            inline size_t GetNumThreads() const { return m_workers.size(); }
+
+            // The emulator the calling thread is parsing, if it is a worker
+            static const TerminalEmulator *GetCurrent();
+
+            // Starts threads workers, 0 starts one per core. Returns nullptr where pseudoterminals can't be
+            // waited on together (Windows).
+            static std::unique_ptr<ParserPool> Create(int threads = 0);
+        };
+    } // namespace Terminal
+} // namespace Hexe
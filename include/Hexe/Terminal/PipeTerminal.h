@@ -0,0 +1,70 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+#pragma once
+
+#include "Hexe/System/IPipe.h"
+#include "IPseudoTerminal.h"
+#include <memory>
+#include <string>
+
+namespace Hexe
+{
+    namespace Terminal
+    {
+        // Shows a process started with IProcessFactory::CreateWithStdioPipe() in a TerminalEmulator. It does what
+        // the line discipline of a pseudoterminal would do: newlines in the output return the carriage too, and
+        // Return in the input ends a line. The process can't ask for its size, so Resize() only records it.
+        class PipeTerminal final : public IPseudoTerminal
+        {
+        private:
+            std::unique_ptr<System::IPipe> m_pipe;
+            int m_columns;
+            int m_rows;
+            bool m_newline; /* the newline after a carriage return that didn't fit the last Read() */
+            std::string m_input;
+
+            PipeTerminal(std::unique_ptr<System::IPipe> &&pipe, int columns, int rows);
+
+        public:
+            virtual ~PipeTerminal() = default;
+            PipeTerminal(PipeTerminal &&) = delete;
+            PipeTerminal(const PipeTerminal &) = delete;
+            PipeTerminal &operator=(PipeTerminal &&) = delete;
+            PipeTerminal &operator=(const PipeTerminal &) = delete;
+
+            virtual bool IsTTY() const override;
+
+            virtual int GetNumColumns() const override;
+            virtual int GetNumRows() const override;
+
+            virtual bool Resize(int columns, int rows) override;
+            virtual int Write(const char *s, size_t n) override;
+            virtual int Read(char *buf, size_t n, bool block = false) override;
+            virtual void Interrupt() override;
+            virtual int GetPollFd() const override;
+            virtual size_t GetPending() const override;
+            virtual bool Tee(int fd) override;
+
+            static std::unique_ptr<PipeTerminal> Create(std::unique_ptr<System::IPipe> &&pipe, int columns, int rows);
+        };
+    } // namespace Terminal
+} // namespace Hexe
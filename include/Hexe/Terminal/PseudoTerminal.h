@@ -24,6 +24,9 @@
 #include "Hexe/AutoHandle.h"
 #include "IPseudoTerminal.h"
 #include <memory>
+#ifdef WIN32
+#include <atomic>
+#endif
 
 namespace Hexe
 {
@@ -45,6 +48,7 @@ namespace Hexe
             HPCON m_phPC;
 
             bool m_attached;
+            std::atomic<bool> m_interrupted;
 
             PseudoTerminal(int columns, int rows, AutoHandle &&hInput, AutoHandle &&hOutput, HPCON hPC);
 #else
@@ -53,8 +57,10 @@ namespace Hexe
 
             AutoHandle m_master;
             AutoHandle m_slave;
+            AutoHandle m_wakeRead; /* becomes readable when Interrupt() is called */
+            AutoHandle m_wakeWrite;
 
-            PseudoTerminal(int columns, int rows, AutoHandle &&master, AutoHandle &&slave);
+            PseudoTerminal(int columns, int rows, AutoHandle &&master, AutoHandle &&slave, AutoHandle &&wakeRead, AutoHandle &&wakeWrite);
 #endif
         public:
             virtual ~PseudoTerminal();
@@ -72,6 +78,11 @@ namespace Hexe
             virtual bool Resize(int columns, int rows) override;
             virtual int Write(const char *s, size_t n) override;
             virtual int Read(char *buf, size_t n, bool block = false) override;
+            virtual void Interrupt() override;
+#ifndef WIN32
+            virtual int GetPollFd() const override;
+            virtual size_t GetPending() const override;
+#endif
 
             static std::unique_ptr<PseudoTerminal> Create(int columns, int rows);
         };
@@ -0,0 +1,98 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+
+namespace Hexe
+{
+    namespace Terminal
+    {
+        class SpscRing;
+
+        // Records the output of a session with timestamps, see TerminalEmulator::SetRecorder(). Record() only
+        // copies the output into a ring in memory and never blocks. A thread of its own writes the ring to the
+        // file in large sequential writes, once it is a quarter full or a second has passed. Output that doesn't
+        // fit the ring, because the disk can't keep up, is dropped and counted, and the next frame tells how
+        // much is missing before it.
+        //
+        // The file starts with the 8 bytes "HEXEREC1" and the start time in microseconds since the Unix epoch.
+        // Each frame follows as the microseconds since the start (64 bits), the nb of bytes of output (32 bits),
+        // the nb of bytes dropped right before it (32 bits) and the output itself. Numbers are in host byte
+        // order. Output dropped at the end is told by a last frame without output.
+        class SessionRecorder final
+        {
+        private:
+            FILE *m_file;
+            std::unique_ptr<SpscRing> m_ring;
+            size_t m_flushsize;
+            std::chrono::steady_clock::time_point m_start;
+
+            std::thread m_thread;
+            std::mutex m_lock;
+            std::condition_variable m_ready; /* the ring filled up to m_flushsize, or m_stop was set */
+            std::atomic<bool> m_idle;        /* the writer sleeps until the next flush */
+            bool m_stop;
+
+            uint64_t m_gap; /* bytes dropped since the last frame that made it, producer only */
+            std::atomic<uint64_t> m_recorded;
+            std::atomic<uint64_t> m_dropped;
+            std::atomic<uint64_t> m_droppedFrames;
+            std::atomic<int> m_error;
+
+            SessionRecorder(FILE *file, size_t budget);
+
+            void writer();
+            void flush();
+
+        public:
+            ~SessionRecorder();
+            SessionRecorder(const SessionRecorder &) = delete;
+            SessionRecorder(SessionRecorder &&) = delete;
+            SessionRecorder &operator=(const SessionRecorder &) = delete;
+            SessionRecorder &operator=(SessionRecorder &&) = delete;
+
+            // Creates or truncates the file at path. The ring takes budget bytes, rounded down to a power of
+            // two, which also bounds the largest frame. Returns nullptr if the file can't be opened.
+            static std::unique_ptr<SessionRecorder> Create(const std::string &path, size_t budget = 4 << 20);
+
+            // Appends a frame with the output buf, stamped with the current time. Called by one thread at a
+            // time, which is the thread that reads the pseudoterminal.
+            void Record(const char *buf, size_t n);
+
+            // Bytes of output framed into the ring, and bytes and frames dropped because the ring was full
+            inline uint64_t GetRecorded() const { return m_recorded.load(std::memory_order_relaxed); }
+            inline uint64_t GetDropped() const { return m_dropped.load(std::memory_order_relaxed); }
+            inline uint64_t GetDroppedFrames() const { return m_droppedFrames.load(std::memory_order_relaxed); }
+            // errno of the first write to the file that failed, 0 if none did. Frames are discarded after it.
+            inline int GetError() const { return m_error.load(std::memory_order_relaxed); }
+        };
+    } // namespace Terminal
+} // namespace Hexe
@@ -63,10 +63,20 @@ namespace Hexe
             virtual void SetClipboard(const char *text);
             virtual const char *GetClipboard() const;
 
+            // Shows the attached emulator offset lines back in its scrollback history, 0 is the live screen.
+            // Rows passed to DrawLine and DrawCursor are view rows, the cursor row is past the last row when
+            // it is scrolled out of view.
+            virtual void SetViewOffset(int offset);
+            int GetViewOffset() const;
+
             virtual bool DrawBegin(int columns, int rows) = 0;
+            // Called for changed rows only, with the changed columns x1..x2-1. A wide character is never split.
             virtual void DrawLine(Line line, int x1, int y, int x2) = 0;
             virtual void DrawCursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og) = 0;
             virtual void DrawEnd() = 0;
+            // Whether the frame finished with the last DrawEnd() has been presented. A parser thread holds its
+            // damage back until then and leaves it to the next frame, so it never draws faster than the display.
+            virtual bool WantsFrame() const { return true; }
         };
     } // namespace Terminal
 } // namespace Hexe
@@ -39,8 +39,12 @@
 #include "TerminalDisplay.h"
 #include "IPseudoTerminal.h"
 #include "../System/IProcess.h"
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <stdint.h>
+#include <vector>
 #include <sys/types.h>
 #ifdef WIN32
 #include <windows.h>
@@ -50,11 +54,22 @@ namespace Hexe
 {
     namespace Terminal
     {
+        class TerminalReactor;
+        class ParserPool;
+        class SessionRecorder;
+
         constexpr int ESC_BUF_SIZ = 512;
         constexpr int ESC_ARG_SIZ = 16;
         constexpr int STR_BUF_SIZ = ESC_BUF_SIZ;
         constexpr int STR_ARG_SIZ = ESC_ARG_SIZ;
 
+        /* Changed columns x1..x2-1 of a line, none when x2 <= x1 */
+        typedef struct
+        {
+            int x1;
+            int x2;
+        } Damage;
+
         /* Internal representation of the screen */
         typedef struct
         {
@@ -62,31 +77,45 @@ namespace Hexe
             int col;         /* nb col */
             Line *line;      /* screen */
             Line *alt;       /* alternate screen */
-            int *dirty;      /* dirtyness of lines */
+            Damage *dirty;   /* dirtyness of lines */
             TCursor c;       /* cursor */
+            TCursor sc[2];   /* saved cursor of each screen */
             int ocx;         /* old cursor col */
             int ocy;         /* old cursor row */
             int top;         /* top    scroll limit */
             int bot;         /* bottom scroll limit */
             int mode;        /* terminal mode flags */
-            int esc;         /* escape state flags */
+            int esc;         /* escape parser state */
             char trantbl[4]; /* charset table translation */
             int charset;     /* current charset */
             int icharset;    /* selected charset for sequence */
             int *tabs;
-            Rune lastc; /* last printed char outside of sequence, 0 if control */
+            Rune lastc;  /* last printed char outside of sequence, 0 if control */
+            Cell *arena;    /* cells of every line, see tarena() */
+            int arenacap;   /* nb of lines the arena holds */
+            int arenalen;   /* nb of lines handed out */
+            int stride;     /* nb of cells per arena line, at least col */
+            Line *ring;     /* history and main screen lines */
+            int ringcap;    /* nb of lines in the ring */
+            int head;       /* ring index of the first main screen line */
+            Line *altring;  /* alternate screen lines */
+            int althead;    /* ring index of the first alternate screen line */
+            int histlen;    /* nb of history lines in use */
+            int histmax;    /* max nb of history lines */
+            int scr;        /* nb of history lines the view is scrolled back */
         } Term;
 
         /* CSI Escape sequence structs */
-        /* ESC '[' [[ [<priv>] <arg> [;]] <mode> [<mode>]] */
+        /* ESC '[' [[ [<priv>] <arg> [;|:]] [<inter>] <final> */
         typedef struct
         {
-            char buf[ESC_BUF_SIZ]; /* raw string */
-            size_t len;            /* raw string length */
-            char priv;
+            char priv;   /* private marker, '?' for DEC modes */
+            char inter;  /* intermediate byte, also used for plain ESC */
+            int ninter;  /* nb of intermediate bytes seen */
             int arg[ESC_ARG_SIZ];
-            int narg; /* nb of args */
-            char mode[2];
+            uint32_t sub; /* bit n is set when arg[n] follows a ':' */
+            int narg;     /* nb of args, index of the current one while parsing */
+            char mode[2]; /* <final> or <inter> <final> */
         } CSIEscape;
 
         /* STR Escape sequence structs */
@@ -101,6 +130,26 @@ namespace Hexe
             int narg; /* nb of args */
         } STREscape;
 
+        /* UTF-8 decoder state, carries incomplete sequences across reads */
+        typedef struct
+        {
+            Rune cp;  /* code point decoded so far */
+            int need; /* nb of continuation bytes still missing */
+            int len;  /* length of the whole sequence */
+        } UTF8Decoder;
+
+#ifdef HEXE_PACKED_CELLS
+        /* Colors shared by packed cells */
+        typedef struct
+        {
+            uint32_t fg;
+            uint32_t bg;
+        } Style;
+
+        constexpr size_t STYLE_MAX = 0xffff;
+        constexpr ushort STYLE_NONE = 0xffff;
+#endif
+
         int isboxdraw(Rune);
         ushort boxdrawindex(const Glyph *);
 
@@ -112,22 +161,62 @@ namespace Hexe
             using ProcPtr = std::unique_ptr<System::IProcess>;
 
         private:
+            friend class TerminalReactor;
+            friend class ParserPool;
+
             DpyPtr m_dpy;
             PtyPtr m_pty;
             ProcPtr m_process;
 
             bool m_colorsLoaded;
-            int m_exitCode;
+            std::atomic<int> m_exitCode; /* set before m_status becomes TERMINATED */
 
-            enum
+            enum Status
             {
                 STARTING = 0,
                 RUNNING,
                 TERMINATED
-            } m_status;
-
-            char m_buf[8192];
-            int m_buflen;
+            };
+            std::atomic<Status> m_status; /* HasExited() and GetExitCode() read both without the lock */
+
+            std::vector<char> m_buf; /* parsed in place, a split UTF-8 sequence is kept in m_utf8 */
+            size_t m_readsize;       /* size of the next read, adapted to the output rate */
+            size_t m_readbatch;      /* bytes ttyreadn() reads at most, adapted the same way */
+            UTF8Decoder m_utf8;
+
+            std::vector<char> m_wqueue; /* input the pty didn't take yet, from m_wqueuepos on */
+            size_t m_wqueuepos;
+
+            struct Reader;
+            std::unique_ptr<Reader> m_reader; /* optional pty reader and parser threads */
+            mutable std::mutex m_lock;        /* held by the parser thread while it parses and draws */
+            TerminalReactor *m_reactor;       /* reads the pty instead of Update() when set */
+            ParserPool *m_pool;               /* reads and parses the pty on its workers when set */
+            bool m_redraw;                    /* the display changed without damaging a row */
+            bool m_hungup;                    /* the reactor or the pool read the pty to its hangup */
+            bool m_exitwatch;                 /* the reactor waits on the process, Update() doesn't poll its exit */
+            int m_exitgrace;                  /* nb of updates to wait for the last output once the process has exited */
+            std::shared_ptr<SessionRecorder> m_recorder; /* gets everything read from the pty */
+
+            int m_histlines;
+            size_t m_histbytes;
+
+            bool m_diffDamage;
+            uint64_t m_damageChecks; /* nb of cells compared before a write */
+            uint64_t m_damageHits;   /* nb of compared cells that were unchanged */
+
+            int m_jumpScroll;                                 /* screens of backlog that skip drawing, 0 never skips */
+            unsigned int m_jumpDeadline;                      /* ms without a frame at most while skipping */
+            size_t m_jumpBytes;                               /* nb of bytes parsed since the last frame */
+            std::chrono::steady_clock::time_point m_lastDraw; /* when the last frame was drawn */
+            uint64_t m_skippedFrames;                         /* nb of frames left out by jump scroll */
+
+#ifdef HEXE_PACKED_CELLS
+            std::vector<Style> m_styles;     /* interned colors, 0 is the default colors */
+            std::vector<ushort> m_styleSlots; /* open addressed index into m_styles */
+            ushort m_lastStyle;
+            int m_styleGcDelay; /* nb of style misses before the next scan */
+#endif
 
         private:
             Term term;
@@ -155,10 +244,9 @@ namespace Hexe
         private:
             void csidump();
             void csihandle();
-            void csiparse();
             void csireset();
 
-            int eschandle(uchar);
+            void eschandle(uchar);
 
             void strdump();
             void strhandle();
@@ -184,18 +272,27 @@ namespace Hexe
             void treset();
             void tscrollup(int, int);
             void tscrolldown(int, int);
-            void tsetattr(int *, int);
+            void tsetattr(int *, uint32_t, int);
             void tsetchar(Rune, Glyph *, int, int);
+            Cell tcell(const Glyph *);
+#ifdef HEXE_PACKED_CELLS
+            ushort tstyle(uint32_t, uint32_t);
+            void tstylerehash(size_t);
+            void tstylegc();
+#endif
             void tsetdirt(int, int);
+            void tsetdirtcols(int, int, int);
             void tsetscroll(int, int);
             void tswapscreen();
             void tsetmode(int, int, int *, int);
-            int twrite(const char *, int, int);
+            void twrite(const char *, size_t, int, UTF8Decoder *);
+            void twritenarrow(const Rune *, int);
             void tfulldirt();
+            void tmirror(int, int);
             void tcontrolcode(uchar);
             void tdectest(char);
             void tdefutf8(char);
-            int32_t tdefcolor(int *, int *, int);
+            int32_t tdefcolor(int *, uint32_t, int *, int);
             void tdeftran(char);
             void tstrsequence(uchar);
 
@@ -206,17 +303,32 @@ namespace Hexe
         private:
             void _die(const char *, ...);
             void drawregion(TerminalDisplay &dpy, int, int, int, int);
-            void draw();
+            bool draw(bool paced = false);
 
             int tattrset(int);
             void tnew(int, int);
             void tresize(int, int);
+            void tarena(int, int, int);
+            Line tarenaline();
+            void tscrollring(int);
+            void hclear();
             void tsetdirtattr(int);
+            int tisdirty();
 
             void ttyhangup();
             size_t ttyread();
+            size_t ttyreadn();
+            int ttybatch(bool);
+            size_t ttydrain(size_t);
+            size_t ttypending();
+            bool ttyjump();
+            void ttyreader();
+            void ttyparser();
             void ttywrite(const char *, size_t, int);
             void ttywriteraw(const char *, size_t);
+            size_t ttyflush();
+            inline size_t ttyqueued() const { return m_wqueue.size() - m_wqueuepos; }
+            void procexit();
 
             void resettitle();
 
@@ -242,7 +354,7 @@ namespace Hexe
             void xximspot(int, int);
 
         private:
-            TerminalEmulator(PtyPtr &&pty, ProcPtr &&process, const std::shared_ptr<TerminalDisplay> &display);
+            TerminalEmulator(PtyPtr &&pty, ProcPtr &&process, const std::shared_ptr<TerminalDisplay> &display, int columns, int rows);
 
         public:
             ~TerminalEmulator();
@@ -253,23 +365,95 @@ namespace Hexe
 
         public:
             static std::unique_ptr<TerminalEmulator> Create(PtyPtr &&pty, ProcPtr &&process, const std::shared_ptr<TerminalDisplay> &display);
+            // Creates a headless emulator without a pseudoterminal or process. Input is supplied with Feed(),
+            // and the display is optional.
+            static std::unique_ptr<TerminalEmulator> Create(int columns, int rows, const std::shared_ptr<TerminalDisplay> &display = nullptr);
 
         public:
+            // Gives an emulator created without one the pseudoterminal and process it runs, once they were started,
+            // for instance by IProcessFactory::CreateWithPseudoTerminalAsync(). The pseudoterminal is resized to the
+            // emulator. Returns false if the emulator has a pseudoterminal already.
+            bool Attach(PtyPtr &&pty, ProcPtr &&process);
             void Resize(int columns, int rows);
             void Redraw();
             void LogError(const char *err);
-            void Update();
+            // Parses what the pseudoterminal has sent since the last update and draws it, as one frame no matter how
+            // much it was. Returns whether a frame was drawn, false when nothing changed, so the host can skip its own.
+            bool Update();
+            // Moves reading the pseudoterminal to a thread of its own, which blocks in Read() and queues the
+            // output in a ring of ringsize bytes (0 uses the configured size). Update() then parses whatever
+            // the thread has queued instead of polling. Returns false without a pseudoterminal, if the
+            // reader is already running, or if a TerminalReactor or a ParserPool reads the pseudoterminal.
+            bool StartReader(size_t ringsize = 0);
+            // Also parses on a thread of its own, which draws to the display after every batch of output,
+            // starting the reader first if needed. The display is then called from that thread, so it has
+            // to hand finished frames to the thread that renders them. Anything else that touches the
+            // screen from another thread (input, Resize(), selection, scrolling) must hold GetLock().
+            bool StartParser(size_t ringsize = 0);
+            // Whether this is the parser thread, or a ParserPool worker parsing this emulator. A display that owns its emulator must not be destroyed on
+            // it, as that would make the thread join itself.
+            bool IsParserThread() const;
+            // Records everything read from the pseudoterminal from now on, nullptr stops recording. The recorder
+            // is fed by whichever thread reads, so it has to be set before reading moves off the caller's thread:
+            // before StartReader() or StartParser(), and before adding the emulator to a TerminalReactor or
+            // ParserPool. Returns false after that.
+            bool SetRecorder(const std::shared_ptr<SessionRecorder> &recorder);
+            inline const std::shared_ptr<SessionRecorder> &GetRecorder() const { return m_recorder; }
+            inline std::mutex &GetLock() { return m_lock; }
+            void Feed(const char *buf, size_t buflen);
             void Terminate();
             bool HasExited() const;
             int GetExitCode() const;
-            inline bool IsSelected(int column, int row) { return selected(column, row); }
+            inline bool IsSelected(int column, int row) { return selected(column, row - term.scr); }
+            bool IsLineSelected(int row);
             inline uint32_t GetDefaultForeground() const { return defaultfg; }
             inline uint32_t GetDefaultBackground() const { return defaultbg; }
             inline uint32_t GetDefaultCursorColor() const { return defaultcs; }
             inline uint32_t GetDefaultReverseCursorColor() const { return defaultrcs; }
             inline int GetNumColumns() const { return term.col; }
             inline int GetNumRows() const { return term.row; }
-            inline int Write(const char *buf, size_t buflen) { return m_pty->Write(buf, (int)buflen); }
+            inline int GetCursorColumn() const { return term.c.x; }
+            inline int GetCursorRow() const { return term.c.y; }
+            inline const Cell *GetLine(int row) const { return term.line[row]; }
+            // Resolves a cell from GetLine() or TerminalDisplay::DrawLine() into its character and attributes
+#ifdef HEXE_PACKED_CELLS
+            inline Glyph GetGlyph(const Cell &c) const
+            {
+                const Style &s = m_styles[c.style];
+                return Glyph{c.u, c.mode, s.fg, s.bg};
+            }
+#else
+            inline Glyph GetGlyph(const Cell &c) const { return c; }
+#endif
+            // Sends input to the pseudoterminal. Whatever it can't take right away is queued and written as it
+            // takes it, by Update(), the parser or the reactor, so this never blocks.
+            int Write(const char *buf, size_t buflen);
+            // Nb of bytes of input still queued for the pseudoterminal. A caller with a lot to write can hold
+            // back while the child isn't reading.
+            inline size_t GetWriteQueued() const { return ttyqueued(); }
+            // Scrollback history of the main screen. The smaller of the two limits applies, a byte limit of 0
+            // means no byte limit. Changing the limits discards history that no longer fits.
+            void SetScrollback(int lines, size_t bytes);
+            inline int GetScrollbackLines() const { return term.histlen; }
+            // Bytes used by both screens and the scrollback history
+            size_t GetMemoryUsage() const;
+            // Scrolls the view offset lines back into the history, 0 shows the live screen. Rows passed to
+            // IsSelected() are view rows.
+            void SetViewOffset(int offset);
+            inline int GetViewOffset() const { return term.scr; }
+            // Compares rewritten cells with their old contents, so cells written with what they already hold
+            // are not reported to the display. The counters tell how many cells were compared and how many
+            // of them were unchanged.
+            inline void SetDiffDamage(bool enable) { m_diffDamage = enable; }
+            inline bool GetDiffDamage() const { return m_diffDamage; }
+            inline uint64_t GetDamageChecks() const { return m_damageChecks; }
+            inline uint64_t GetDamageHits() const { return m_damageHits; }
+            // Jump scroll: while more than screens screens of output are parsed or pending since the last frame,
+            // the frames in between are not drawn, except one every deadline ms. The counter tells how many
+            // frames were left out. 0 screens draws every frame.
+            inline void SetJumpScroll(int screens, unsigned int deadline) { m_jumpScroll = screens; m_jumpDeadline = deadline; }
+            inline int GetJumpScroll() const { return m_jumpScroll; }
+            inline uint64_t GetSkippedFrames() const { return m_skippedFrames; }
 
         public:
             void printscreen(const Arg *);
@@ -0,0 +1,80 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+#pragma once
+
+#include "Hexe/AutoHandle.h"
+#include <memory>
+#include <vector>
+
+namespace Hexe
+{
+    namespace Terminal
+    {
+        class TerminalEmulator;
+
+        // Waits on the pseudoterminals of many emulators at once, so an idle terminal costs nothing per frame.
+        // A registered emulator no longer reads its pseudoterminal in Update(), Dispatch() reads the ones that
+        // have output instead. Both must be called from the same thread. The reactor has to outlive the
+        // emulators registered with it, and emulators with a reader thread can't be registered.
+        class TerminalReactor final
+        {
+        private:
+            friend class TerminalEmulator;
+
+            AutoHandle m_epoll;
+            AutoHandle m_wake; /* eventfd, readable after Wakeup() */
+            std::vector<TerminalEmulator *> m_terminals;
+
+            TerminalReactor(AutoHandle &&epoll, AutoHandle &&wake);
+            void WatchWrite(TerminalEmulator &terminal, bool watch);
+
+        public:
+            ~TerminalReactor();
+            TerminalReactor(const TerminalReactor &) = delete;
+            TerminalReactor(TerminalReactor &&) = delete;
+            TerminalReactor &operator=(const TerminalReactor &) = delete;
+            TerminalReactor &operator=(TerminalReactor &&) = delete;
+
+            bool Add(TerminalEmulator &terminal);
+            void Remove(TerminalEmulator &terminal);
+            inline size_t GetNumTerminals() const { return m_terminals.size(); }
+
+            // Reads from every registered pseudoterminal with output, waiting up to timeout milliseconds
+            // (-1 waits forever) for one to have some, and writes queued input to the ones that take it
+            // again. A process that exited is reaped as well, and its emulator terminated once its output
+            // is read to the end, whether it is updated or not. Returns the nb of terminals that were read
+            // or whose process exited.
+            int Dispatch(int timeout = 0);
+            // Blocks until Dispatch() has something to do, or Wakeup() is called. Unlike Dispatch() it may be
+            // called from any thread, for instance to wake a host loop that waits on something else.
+            bool Wait(int timeout = -1);
+            // Makes Wait() return, and keeps it returning until the next Dispatch()
+            void Wakeup();
+            // A descriptor that polls readable whenever Wait() would return, to wait on it together with
+            // descriptors of the host
+            int GetWakeupFd() const;
+
+            // Returns nullptr where pseudoterminals can't be waited on together (Windows)
+            static std::unique_ptr<TerminalReactor> Create();
+        };
+    } // namespace Terminal
+} // namespace Hexe
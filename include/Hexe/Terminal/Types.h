@@ -117,7 +117,19 @@ namespace Hexe
             uint32_t bg; /* background  */
         } Glyph;
 
-        typedef Glyph *Line;
+#ifdef HEXE_PACKED_CELLS
+        /* Screen cell of the packed layout, colors are interned in a style table */
+        typedef struct
+        {
+            Rune u;       /* character code */
+            ushort mode;  /* attribute flags */
+            ushort style; /* index into the style table of the emulator */
+        } Cell;
+#else
+        typedef Glyph Cell;
+#endif
+
+        typedef Cell *Line;
 
         union Arg
         {
@@ -173,15 +185,19 @@ namespace Hexe
             CS_FIN
         };
 
+        /* states of the DEC/ANSI escape sequence parser */
         enum escape_state
         {
-            ESC_START = 1,
-            ESC_CSI = 2,
-            ESC_STR = 4, /* DCS, OSC, PM, APC */
-            ESC_ALTCHARSET = 8,
-            ESC_STR_END = 16, /* a final string was encountered */
-            ESC_TEST = 32,    /* Enter in test mode */
-            ESC_UTF8 = 64,
+            ESC_GROUND = 0,
+            ESC_ESCAPE,           /* ESC was received */
+            ESC_INTERMEDIATE,     /* ESC followed by intermediate bytes */
+            ESC_CSI_ENTRY,        /* CSI was received */
+            ESC_CSI_PARAM,        /* collecting CSI parameters */
+            ESC_CSI_INTERMEDIATE, /* collecting CSI intermediate bytes */
+            ESC_CSI_IGNORE,       /* malformed CSI, skip until the final byte */
+            ESC_STR,              /* DCS, OSC, PM, APC, SOS */
+            ESC_STR_END,          /* ESC inside a string, ST may follow */
+            ESC_STATE_COUNT
         };
 
         typedef struct
@@ -64,6 +64,7 @@ void Hexe::AutoHandle::Release() const
     if (m_hHandle != -1)
     {
         close(m_hHandle);
+        m_hHandle = -1;
     }
 }
 
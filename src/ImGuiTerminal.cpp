@@ -28,7 +28,9 @@
 #include "ImGuiTerminal.colors.h"
 #include "ImGuiTerminal.keys.h"
 #include "imgui_internal.h"
+#include <chrono>
 #include <cmath>
+#include <thread>
 
 #undef min
 #undef max
@@ -231,24 +233,48 @@ inline static void drawbox(float x, float y, float w, float h, ImU32 fg, ImU32 b
     }
 }
 
-static inline ImU32 GetCol(unsigned int terminalColor, const ImVector<std::pair<ImU32, std::string>> &colors)
+static inline ImU32 GetCol(unsigned int terminalColor, const ImVector<ImU32> &colors)
 {
     if ((terminalColor & (1 << 24)) == 0)
     {
-        return colors[terminalColor & 0xFF].first;
+        return colors[terminalColor & 0xFF];
     }
     return IM_COL32((terminalColor >> 16) & 0xFF, (terminalColor >> 8) & 0xFF, terminalColor & 0xFF, (~((terminalColor >> 25) & 0xFF)) & 0xFF);
 }
 
 ImGuiTerminal::ImGuiTerminal(int columns, int rows, ImGuiTerminalConfig *config)
-    : m_borderpx(1.0f), m_cursorthickness(2.0f), m_cursorx(0), m_cursory(0), m_cursorg({}), m_columns(columns), m_rows(rows), m_dirty(true), m_checkDirty(false), m_flags(0), m_useBoxDrawing(true), m_useColorEmoji(false), m_pasteNewlineFix(false), m_elapsedTime(0.0), m_lastBlink(0.0), m_defaultFont(nullptr), m_boldFont(nullptr), m_italicFont(nullptr), m_boldItalicFont(nullptr)
+    : m_borderpx(1.0f), m_cursorthickness(2.0f), m_cursorx(0), m_cursory(0), m_cursorg({}), m_columns(columns), m_rows(rows), m_dirty(true), m_checkDirty(false), m_flags(0), m_useBoxDrawing(true), m_useColorEmoji(false), m_pasteNewlineFix(false), m_blink(false), m_drawHasBlink(false), m_lastBlink(Now()), m_frameSerial(0), m_spawnOptions(0), m_defaultFont(nullptr), m_boldFont(nullptr), m_italicFont(nullptr), m_boldItalicFont(nullptr)
 {
+    for (auto &frame : m_frames)
+    {
+        frame.layout = 0;
+        frame.columns = 0;
+        frame.rows = 0;
+        frame.colorsVersion = 0;
+        frame.titleVersion = 0;
+        frame.clipboardVersion = 0;
+        frame.serial = 0;
+    }
+    m_drawCache.serial = 0;
+    m_pastePos = 0;
+    m_pasteBracketed = false;
+    m_back = 0;
+    m_pending = 1;
+    m_front = 2;
+    m_layout = 1;
+    m_colorsVersion = 1;
+    m_titleVersion = 1;
+    m_clipboardVersion = 0;
+    m_clipboardSeen = 0;
+    m_cursorSelected = false;
+
     Hexe::Terminal::Glyph defaultGlyph;
     defaultGlyph.mode = ATTR_INVISIBLE;
     auto defaultColor = std::make_pair<ImU32, std::string>(0U, "");
     m_cursorg = defaultGlyph;
     m_colors.resize(LEN(colornames), defaultColor);
     m_buffer.resize(m_columns * m_rows, defaultGlyph);
+    m_rowVersions.resize(m_rows, 0);
     ((int &)m_mode) |= MODE_FOCUSED;
 
     memset(&m_mouseState, 0, sizeof(m_mouseState));
@@ -264,9 +290,51 @@ ImGuiTerminal::ImGuiTerminal(int columns, int rows, ImGuiTerminalConfig *config)
     }
 }
 
-void ImGuiTerminal::Update()
+bool ImGuiTerminal::Update()
 {
+    if (m_spawn.valid() && m_spawn.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        Spawned();
+
     m_terminal->Update();
+
+    if (IsPasting())
+    {
+        bool exited = m_terminal->HasExited();
+        std::lock_guard<std::mutex> lock(m_terminal->GetLock());
+        if (exited)
+            CancelPaste();
+        else
+            PasteChunk();
+    }
+
+    bool fresh = m_pending.load(std::memory_order_relaxed) & FRAME_FRESH;
+    AcquireFrame();
+
+    /* blinking text needs a frame of its own every blink */
+    return fresh || (m_drawHasBlink && Now() - m_lastBlink > 0.7);
+}
+
+void ImGuiTerminal::Spawned()
+{
+    auto spawned = m_spawn.get();
+
+    if (!spawned.process || !m_terminal->Attach(std::move(spawned.pseudoTerminal), std::move(spawned.process)))
+    {
+        fprintf(stderr, "Failed to spawn process\n");
+        m_terminal->Terminate();
+        return;
+    }
+    StartThreads(m_spawnOptions);
+}
+
+bool ImGuiTerminal::WantsFrame() const
+{
+    return !(m_pending.load(std::memory_order_relaxed) & FRAME_FRESH);
+}
+
+double ImGuiTerminal::Now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 void ImGuiTerminal::MouseReport(int x, int y, int button, int state, int type)
@@ -276,6 +344,9 @@ void ImGuiTerminal::MouseReport(int x, int y, int button, int state, int type)
         return;
     }
 
+    // Selections are in screen rows, which reach into the history when the view is scrolled back
+    y -= m_terminal->GetViewOffset();
+
     if (type == 1)
     {
         int tx = x;
@@ -330,6 +401,11 @@ void ImGuiTerminal::ProcessInput(int mouse_column, int mouse_row)
         }
     }
 
+    if (isHovered && io.MouseWheel != 0.0f)
+    {
+        SetViewOffset(GetViewOffset() + (int)(io.MouseWheel * 3.0f));
+    }
+
     auto keyModFlags = io.KeyMods;
 
     // Process regular text input (before we check for Return because using some IME will effectively send a Return?)
@@ -432,18 +508,29 @@ void ImGuiTerminal::Action(ShortcutAction action)
 {
     if (action == ShortcutAction::PASTE)
     {
-        auto clipboard = GetClipboard();
-        auto clipboardLen = strlen(clipboard);
-        if (clipboardLen > 0)
-        {
-            m_terminal->Write(clipboard, clipboardLen);
-        }
+        auto clipboard = ImGui::GetClipboardText();
+        if (clipboard)
+            Paste(clipboard, strlen(clipboard));
+    }
+    else if (action == ShortcutAction::CANCEL_PASTE)
+    {
+        CancelPaste();
+    }
+    else if (action == ShortcutAction::SCROLL_UP)
+    {
+        SetViewOffset(GetViewOffset() + m_rows);
+    }
+    else if (action == ShortcutAction::SCROLL_DOWN)
+    {
+        SetViewOffset(GetViewOffset() - m_rows);
     }
 }
 
 void ImGuiTerminal::SetClipboard(const char *text)
 {
-    ImGui::SetClipboardText(text);
+    /* this may run on the parser thread, the clipboard is set when the frame is rendered */
+    m_clipboard = text ? text : "";
+    ++m_clipboardVersion;
 }
 
 const char *ImGuiTerminal::GetClipboard() const
@@ -464,6 +551,71 @@ const char *ImGuiTerminal::GetClipboard() const
     return ImGui::GetClipboardText();
 }
 
+void ImGuiTerminal::Paste(const char *text, size_t len)
+{
+    CancelPaste();
+    if (len == 0)
+        return;
+
+    /* the only copy, the chunks are converted from it as they are written */
+    m_paste.assign(text, len);
+    m_pastePos = 0;
+    m_pasteBracketed = m_mode & MODE_BRCKTPASTE;
+    if (m_pasteBracketed)
+        m_terminal->Write("\033[200~", 6);
+    PasteChunk();
+}
+
+void ImGuiTerminal::CancelPaste()
+{
+    if (!IsPasting())
+        return;
+
+    if (m_pasteBracketed)
+        m_terminal->Write("\033[201~", 6);
+    /* a large paste gives its memory back */
+    std::string().swap(m_paste);
+    m_pastePos = 0;
+}
+
+/*
+ * Writes the next chunk of the paste, unless the child hasn't read the last
+ * one yet. CRs are dropped with OPTION_PASTE_CRLF and ESC is dropped from a
+ * bracketed paste in the same pass that copies the chunk.
+ */
+void ImGuiTerminal::PasteChunk()
+{
+    const char *src = m_paste.data() + m_pastePos;
+    const char *end = m_paste.data() + m_paste.size();
+    char *dst, *dstend;
+
+    if (m_terminal->GetWriteQueued() >= PASTE_CHUNK)
+        return;
+
+    m_pasteChunk.resize(PASTE_CHUNK);
+    dst = &m_pasteChunk[0];
+    dstend = dst + PASTE_CHUNK;
+    while (src < end && dst < dstend)
+    {
+        char c = *src++;
+        if ((c == '\r' && m_pasteNewlineFix) || (c == '\033' && m_pasteBracketed))
+            continue;
+        *dst++ = c;
+    }
+
+    m_pastePos = src - m_paste.data();
+    if (dst > m_pasteChunk.data())
+        m_terminal->Write(m_pasteChunk.data(), dst - m_pasteChunk.data());
+
+    if (m_pastePos == m_paste.size())
+    {
+        if (m_pasteBracketed)
+            m_terminal->Write("\033[201~", 6);
+        std::string().swap(m_paste);
+        m_pastePos = 0;
+    }
+}
+
 bool ImGuiTerminal::HasTerminated() const
 {
     return m_terminal->HasExited();
@@ -518,6 +670,7 @@ int ImGuiTerminal::ResetColor(int index, const char *name)
 
             m_colors[index].first = col;
             m_colors[index].second = "";
+            ++m_colorsVersion;
             return 0;
         }
     }
@@ -526,6 +679,7 @@ int ImGuiTerminal::ResetColor(int index, const char *name)
     {
         m_colors[index].first = ColorFromName(name);
         m_colors[index].second = name;
+        ++m_colorsVersion;
     }
 
     return 1;
@@ -534,11 +688,12 @@ int ImGuiTerminal::ResetColor(int index, const char *name)
 void ImGuiTerminal::SetTitle(const char *str)
 {
     m_title = str ? str : "";
+    ++m_titleVersion;
 }
 
 const std::string &ImGuiTerminal::GetTitle() const
 {
-    return m_title;
+    return m_frames[m_front].title;
 }
 
 bool ImGuiTerminal::DrawBegin(int columns, int rows)
@@ -547,8 +702,10 @@ bool ImGuiTerminal::DrawBegin(int columns, int rows)
     {
         Hexe::Terminal::Glyph defaultGlyph;
         m_buffer.resize(columns * rows, defaultGlyph);
+        m_rowVersions.resize(rows, 0);
         m_columns = columns;
         m_rows = rows;
+        ++m_layout;
     }
     m_checkDirty = false;
 
@@ -557,13 +714,17 @@ bool ImGuiTerminal::DrawBegin(int columns, int rows)
 
 void ImGuiTerminal::DrawLine(Hexe::Terminal::Line line, int x1, int y, int x2)
 {
+    bool selection = m_terminal->IsLineSelected(y);
+
     m_checkDirty = true;
-    memcpy(&m_buffer[y * m_columns + x1], line, (x2 - x1) * sizeof(Glyph));
+    ++m_rowVersions[y];
     for (int i = x1; i < x2; i++)
     {
-        if (m_terminal->selected(i, y))
+        auto &g = m_buffer[y * m_columns + i];
+        g = m_terminal->GetGlyph(line[i]);
+        if (selection && m_terminal->IsSelected(i, y))
         {
-            m_buffer[y * m_columns + i].mode |= ATTR_REVERSE;
+            g.mode |= ATTR_REVERSE;
         }
     }
 }
@@ -573,12 +734,84 @@ void ImGuiTerminal::DrawCursor(int cx, int cy, Hexe::Terminal::Glyph g, int ox,
     m_cursorx = cx;
     m_cursory = cy;
     m_cursorg = g;
+    m_cursorSelected = cy < m_rows && m_emulator->IsSelected(cx, cy);
 }
 
 void ImGuiTerminal::DrawEnd()
 {
     if (m_checkDirty)
         m_dirty = true;
+    PublishFrame();
+}
+
+void ImGuiTerminal::PublishFrame()
+{
+    Frame &f = m_frames[m_back];
+
+    if (f.layout != m_layout)
+    {
+        f.buffer = m_buffer;
+        f.rowVersions = m_rowVersions;
+        f.layout = m_layout;
+        f.columns = m_columns;
+        f.rows = m_rows;
+    }
+    else
+    {
+        for (int y = 0; y < m_rows; y++)
+        {
+            if (f.rowVersions[y] == m_rowVersions[y])
+                continue;
+            memcpy(&f.buffer[y * m_columns], &m_buffer[y * m_columns], m_columns * sizeof(Hexe::Terminal::Glyph));
+            f.rowVersions[y] = m_rowVersions[y];
+        }
+    }
+
+    f.cursorx = m_cursorx;
+    f.cursory = m_cursory;
+    f.cursorg = m_cursorg;
+    f.cursorSelected = m_cursorSelected;
+    f.mode = m_mode;
+    f.cursorMode = m_cursorMode;
+    f.defaultfg = m_emulator->GetDefaultForeground();
+    f.defaultbg = m_emulator->GetDefaultBackground();
+    f.defaultcs = m_emulator->GetDefaultCursorColor();
+    f.defaultrcs = m_emulator->GetDefaultReverseCursorColor();
+
+    if (f.colorsVersion != m_colorsVersion)
+    {
+        f.colors.resize(m_colors.Size);
+        for (int i = 0; i < m_colors.Size; i++)
+            f.colors[i] = m_colors[i].first;
+        f.colorsVersion = m_colorsVersion;
+    }
+    if (f.titleVersion != m_titleVersion)
+    {
+        f.title = m_title;
+        f.titleVersion = m_titleVersion;
+    }
+    if (f.clipboardVersion != m_clipboardVersion)
+    {
+        f.clipboard = m_clipboard;
+        f.clipboardVersion = m_clipboardVersion;
+    }
+    f.serial = ++m_frameSerial;
+
+    m_back = m_pending.exchange(m_back | FRAME_FRESH, std::memory_order_acq_rel) & FRAME_INDEX;
+}
+
+ImGuiTerminal::Frame &ImGuiTerminal::AcquireFrame()
+{
+    if (m_pending.load(std::memory_order_relaxed) & FRAME_FRESH)
+        m_front = m_pending.exchange(m_front, std::memory_order_acq_rel) & FRAME_INDEX;
+
+    Frame &f = m_frames[m_front];
+    if (f.clipboardVersion != m_clipboardSeen)
+    {
+        ImGui::SetClipboardText(f.clipboard.c_str());
+        m_clipboardSeen = f.clipboardVersion;
+    }
+    return f;
 }
 
 void ImGuiTerminal::SetFont(ImFont *regular, ImFont *bold, ImFont *italic, ImFont *boldItalic)
@@ -596,17 +829,13 @@ void ImGuiTerminal::Draw(ImDrawList *draw_list, ImVec2 pos, float scale, const I
         m_defaultFont = ImGui::GetDefaultFont();
     }
 
-    if (m_elapsedTime - m_lastBlink > 0.7)
-    {
-        m_mode ^= MODE_BLINK;
-        m_lastBlink = m_elapsedTime;
-    }
+    const Frame &frame = AcquireFrame();
 
     auto fontSize = m_defaultFont->FontSize * scale;
     auto advanceX = m_defaultFont->FindGlyph('A')->AdvanceX * scale;
 
-    auto width = m_columns * advanceX;
-    auto height = m_rows * fontSize;
+    auto width = frame.columns * advanceX;
+    auto height = frame.rows * fontSize;
 
     auto clipWidth = clip_rect.z - clip_rect.x;
     auto clipHeight = clip_rect.w - clip_rect.y;
@@ -627,9 +856,22 @@ void ImGuiTerminal::Draw(ImDrawList *draw_list, ImVec2 pos, float scale, const I
 
     ImDrawList *drawList = ImGui::GetWindowDrawList();
 
-    draw_list->AddRectFilled(ImVec2(clip_rect.x, clip_rect.y), ImVec2(clip_rect.z, clip_rect.w), GetCol(m_emulator->GetDefaultBackground(), m_colors), 0.0f, ImDrawCornerFlags_None);
+    if (Now() - m_lastBlink > 0.7)
+    {
+        m_blink = !m_blink;
+        m_lastBlink = Now();
+    }
+
+    /* nothing is drawn until the emulator has published its first frame */
+    if (frame.layout != 0)
+    {
+        draw_list->AddRectFilled(ImVec2(clip_rect.x, clip_rect.y), ImVec2(clip_rect.z, clip_rect.w), GetCol(frame.defaultbg, frame.colors), 0.0f, ImDrawCornerFlags_None);
+
+        DrawImGui(frame, draw_list, pos, scale, clip_rect);
+    }
 
-    DrawImGui(draw_list, pos, scale, clip_rect);
+    /* the rest touches the emulator, which a parser thread may be drawing */
+    std::lock_guard<std::mutex> lock(m_terminal->GetLock());
 
     if (clipColumns != m_terminal->GetNumColumns() || clipRows != m_terminal->GetNumRows())
     {
@@ -658,12 +900,30 @@ void ImGuiTerminal::Draw(ImDrawList *draw_list, ImVec2 pos, float scale, const I
     }
 }
 
-void ImGuiTerminal::DrawImGui(ImDrawList *draw_list, ImVec2 pos, float scale, const ImVec4 &clip_rect)
+void ImGuiTerminal::DrawImGui(const Frame &frame, ImDrawList *draw_list, ImVec2 pos, float scale, const ImVec4 &clip_rect)
 {
-    auto &io = ImGui::GetIO();
     auto font = m_defaultFont;
 
     ImDrawList *drawList = ImGui::GetWindowDrawList();
+    auto &cache = m_drawCache;
+
+    /* ImGui rebuilds its draw lists every frame, an unchanged terminal copies the vertices it made last time */
+    if (cache.serial == frame.serial && cache.pos.x == pos.x && cache.pos.y == pos.y && cache.scale == scale &&
+        memcmp(&cache.clipRect, &clip_rect, sizeof(ImVec4)) == 0 && (cache.blink == m_blink || !m_drawHasBlink) &&
+        cache.fonts[0] == m_defaultFont && cache.fonts[1] == m_boldFont && cache.fonts[2] == m_italicFont && cache.fonts[3] == m_boldItalicFont &&
+        cache.texId == drawList->CmdBuffer[drawList->CmdBuffer.Size - 1].TextureId &&
+        cache.whitePixel.x == drawList->_Data->TexUvWhitePixel.x && cache.whitePixel.y == drawList->_Data->TexUvWhitePixel.y)
+    {
+        drawList->PrimReserve(cache.idx.Size, cache.vtx.Size);
+        memcpy(drawList->_VtxWritePtr, cache.vtx.Data, cache.vtx.Size * sizeof(ImDrawVert));
+        for (int i = 0; i < cache.idx.Size; i++)
+            drawList->_IdxWritePtr[i] = (ImDrawIdx)(drawList->_VtxCurrentIdx + cache.idx[i]);
+        drawList->_VtxWritePtr += cache.vtx.Size;
+        drawList->_IdxWritePtr += cache.idx.Size;
+        drawList->_VtxCurrentIdx += cache.vtx.Size;
+        return;
+    }
+    m_drawHasBlink = false;
     auto fontSize = font->FontSize;
     auto spaceChar = font->FindGlyph('A');
     auto spaceCharAdvanceX = spaceChar->AdvanceX * scale;
@@ -676,37 +936,42 @@ void ImGuiTerminal::DrawImGui(ImDrawList *draw_list, ImVec2 pos, float scale, co
     ImU32 col = 0xFFFFFFFF;
 
     // 4 vertices per primitive, up to 11 primitives pr char (background, glyph (up to 8 because of boxdraw), strikethrough, underline) and the cursor
-    const int vtx_count_max = (int)(m_columns * m_rows) * 4 * 11 + 16;
+    const int vtx_count_max = (int)(frame.columns * frame.rows) * 4 * 11 + 16;
     // 6 indices per primitive, up to 4 primitives pr char (background, glyph, strikethrough, underline) and the cursor
-    const int idx_count_max = (int)(m_columns * m_rows) * 6 * 11 + 24;
+    const int idx_count_max = (int)(frame.columns * frame.rows) * 6 * 11 + 24;
     const int idx_expected_size = drawList->IdxBuffer.Size + idx_count_max;
     drawList->PrimReserve(idx_count_max, vtx_count_max);
 
     ImDrawVert *vtx_write = drawList->_VtxWritePtr;
     ImDrawIdx *idx_write = drawList->_IdxWritePtr;
     unsigned int vtx_current_idx = drawList->_VtxCurrentIdx;
+    ImDrawVert *vtx_start = vtx_write;
+    ImDrawIdx *idx_start = idx_write;
+    unsigned int vtx_start_idx = vtx_current_idx;
 
-    auto defaultFg = GetCol(m_emulator->GetDefaultForeground(), m_colors);
-    auto defaultBg = GetCol(m_emulator->GetDefaultBackground(), m_colors);
+    const auto &colors = frame.colors;
+    auto defaultFg = GetCol(frame.defaultfg, colors);
+    auto defaultBg = GetCol(frame.defaultbg, colors);
+    auto cursorg = frame.cursorg;
 
-    for (int j = 0; j < m_rows; j++)
+    for (int j = 0; j < frame.rows; j++)
     {
         x = std::floor(pos.x);
 
         if (pos.y + line_height * j > clip_rect.w)
             break;
 
-        for (int i = 0; i < m_columns; i++)
+        for (int i = 0; i < frame.columns; i++)
         {
-            auto &glyph = m_buffer[j * m_columns + i];
-            auto fg = GetCol(glyph.fg, m_colors);
-            auto bg = GetCol(glyph.bg, m_colors);
+            auto &glyph = frame.buffer[j * frame.columns + i];
+            auto fg = GetCol(glyph.fg, colors);
+            auto bg = GetCol(glyph.bg, colors);
             ImU32 temp = 0;
 
             if (m_boldFont == nullptr && (glyph.mode & ATTR_BOLD_FAINT) == ATTR_BOLD && BETWEEN(glyph.fg, 0, 7))
-                fg = GetCol(glyph.fg + 8, m_colors);
+                fg = GetCol(glyph.fg + 8, colors);
 
-            if (IS_SET(MODE_REVERSE))
+            if (frame.mode & MODE_REVERSE)
             {
                 if (fg == defaultFg)
                 {
@@ -758,8 +1023,12 @@ void ImGuiTerminal::DrawImGui(ImDrawList *draw_list, ImVec2 pos, float scale, co
                 bg = temp;
             }
 
-            if (glyph.mode & ATTR_BLINK && m_mode & MODE_BLINK)
-                fg = bg;
+            if (glyph.mode & ATTR_BLINK)
+            {
+                m_drawHasBlink = true;
+                if (m_blink)
+                    fg = bg;
+            }
 
             if (glyph.mode & ATTR_INVISIBLE)
                 fg = bg;
@@ -977,39 +1246,39 @@ void ImGuiTerminal::DrawImGui(ImDrawList *draw_list, ImVec2 pos, float scale, co
     }
 
     {
-        if (!IS_SET(MODE_HIDE))
+        if (!(frame.mode & MODE_HIDE) && frame.cursory < frame.rows)
         {
             ImU32 drawcol;
 
-            m_cursorg.mode &= ATTR_BOLD | ATTR_ITALIC | ATTR_UNDERLINE | ATTR_STRUCK | ATTR_WIDE | ATTR_BOXDRAW;
-            if (IS_SET(MODE_REVERSE))
+            cursorg.mode &= ATTR_BOLD | ATTR_ITALIC | ATTR_UNDERLINE | ATTR_STRUCK | ATTR_WIDE | ATTR_BOXDRAW;
+            if (frame.mode & MODE_REVERSE)
             {
-                m_cursorg.mode |= ATTR_REVERSE;
-                m_cursorg.bg = m_emulator->GetDefaultForeground();
-                if (m_emulator->IsSelected(m_cursorx, m_cursory))
+                cursorg.mode |= ATTR_REVERSE;
+                cursorg.bg = frame.defaultfg;
+                if (frame.cursorSelected)
                 {
-                    drawcol = GetCol(m_emulator->GetDefaultCursorColor(), m_colors);
-                    m_cursorg.fg = m_emulator->GetDefaultReverseCursorColor();
+                    drawcol = GetCol(frame.defaultcs, colors);
+                    cursorg.fg = frame.defaultrcs;
                 }
                 else
                 {
-                    drawcol = GetCol(m_emulator->GetDefaultReverseCursorColor(), m_colors);
-                    m_cursorg.fg = m_emulator->GetDefaultCursorColor();
+                    drawcol = GetCol(frame.defaultrcs, colors);
+                    cursorg.fg = frame.defaultcs;
                 }
             }
             else
             {
-                if (m_emulator->IsSelected(m_cursorx, m_cursory))
+                if (frame.cursorSelected)
                 {
-                    m_cursorg.fg = m_emulator->GetDefaultForeground();
-                    m_cursorg.bg = m_emulator->GetDefaultReverseCursorColor();
+                    cursorg.fg = frame.defaultfg;
+                    cursorg.bg = frame.defaultrcs;
                 }
                 else
                 {
-                    m_cursorg.fg = m_emulator->GetDefaultBackground();
-                    m_cursorg.bg = m_emulator->GetDefaultCursorColor();
+                    cursorg.fg = frame.defaultbg;
+                    cursorg.bg = frame.defaultcs;
                 }
-                drawcol = GetCol(m_cursorg.bg, m_colors);
+                drawcol = GetCol(cursorg.bg, colors);
             }
 
             ImVec2 a{}, b{}, c{}, d{}, uv(drawList->_Data->TexUvWhitePixel);
@@ -1018,12 +1287,12 @@ void ImGuiTerminal::DrawImGui(ImDrawList *draw_list, ImVec2 pos, float scale, co
             auto cursorthickness = m_cursorthickness * scale;
 
             /* draw the new one */
-            if (IS_SET(MODE_FOCUSED))
+            if (frame.mode & MODE_FOCUSED)
             {
-                switch (m_cursorMode)
+                switch (frame.cursorMode)
                 {
                 case 7:                   /* st extension */
-                    m_cursorg.u = 0x2603; /* snowman (U+2603) */
+                    cursorg.u = 0x2603; /* snowman (U+2603) */
                                           /* FALLTHROUGH */
                 case 0:                   /* Blinking Block */
                 case 1:                   /* Blinking Block (Default) */
@@ -1033,15 +1302,15 @@ void ImGuiTerminal::DrawImGui(ImDrawList *draw_list, ImVec2 pos, float scale, co
                     //break;
                 case 3: /* Blinking Underline */
                 case 4: /* Steady Underline */
-                    drawrect(drawcol, pos.x + borderpx + m_cursorx * spaceCharAdvanceX,
-                             pos.y + borderpx + (m_cursory + 1) * line_height - cursorthickness,
+                    drawrect(drawcol, pos.x + borderpx + frame.cursorx * spaceCharAdvanceX,
+                             pos.y + borderpx + (frame.cursory + 1) * line_height - cursorthickness,
                              spaceCharAdvanceX,
                              cursorthickness, vtx_write, idx_write, vtx_current_idx, uv);
                     break;
                 case 5: /* Blinking bar */
                 case 6: /* Steady bar */
-                    drawrect(drawcol, pos.x + m_cursorx * spaceCharAdvanceX,
-                             pos.y + m_cursory * line_height,
+                    drawrect(drawcol, pos.x + frame.cursorx * spaceCharAdvanceX,
+                             pos.y + frame.cursory * line_height,
                              spaceCharAdvanceX, line_height,
                              vtx_write, idx_write, vtx_current_idx, uv);
                     break;
@@ -1049,23 +1318,23 @@ void ImGuiTerminal::DrawImGui(ImDrawList *draw_list, ImVec2 pos, float scale, co
             }
             else
             {
-                drawrect(drawcol, pos.x + borderpx + m_cursorx * spaceCharAdvanceX,
-                         pos.y + borderpx + m_cursory * line_height,
+                drawrect(drawcol, pos.x + borderpx + frame.cursorx * spaceCharAdvanceX,
+                         pos.y + borderpx + frame.cursory * line_height,
                          spaceCharAdvanceX - scale, scale, vtx_write, idx_write, vtx_current_idx, uv);
-                drawrect(drawcol, pos.x + borderpx + m_cursorx * spaceCharAdvanceX,
-                         pos.y + borderpx + m_cursory * line_height,
+                drawrect(drawcol, pos.x + borderpx + frame.cursorx * spaceCharAdvanceX,
+                         pos.y + borderpx + frame.cursory * line_height,
                          scale, line_height - scale,
                          vtx_write, idx_write, vtx_current_idx, uv);
-                drawrect(drawcol, pos.x + borderpx + (m_cursorx + 1) * spaceCharAdvanceX - scale,
-                         pos.y + borderpx + m_cursory * line_height,
+                drawrect(drawcol, pos.x + borderpx + (frame.cursorx + 1) * spaceCharAdvanceX - scale,
+                         pos.y + borderpx + frame.cursory * line_height,
                          scale, line_height - scale,
                          vtx_write, idx_write, vtx_current_idx, uv);
-                drawrect(drawcol, pos.x + borderpx + (m_cursorx + 1) * spaceCharAdvanceX - scale,
-                         pos.y + borderpx + m_cursory * line_height,
+                drawrect(drawcol, pos.x + borderpx + (frame.cursorx + 1) * spaceCharAdvanceX - scale,
+                         pos.y + borderpx + frame.cursory * line_height,
                          scale, line_height - scale,
                          vtx_write, idx_write, vtx_current_idx, uv);
-                drawrect(drawcol, pos.x + borderpx + m_cursorx * spaceCharAdvanceX,
-                         pos.y + borderpx + (m_cursory + 1) * line_height - scale,
+                drawrect(drawcol, pos.x + borderpx + frame.cursorx * spaceCharAdvanceX,
+                         pos.y + borderpx + (frame.cursory + 1) * line_height - scale,
                          spaceCharAdvanceX, scale,
                          vtx_write, idx_write, vtx_current_idx, uv);
             }
@@ -1080,7 +1349,22 @@ void ImGuiTerminal::DrawImGui(ImDrawList *draw_list, ImVec2 pos, float scale, co
     drawList->_IdxWritePtr = idx_write;
     drawList->_VtxCurrentIdx = vtx_current_idx;
 
-    m_elapsedTime += io.DeltaTime;
+    cache.serial = frame.serial;
+    cache.pos = pos;
+    cache.scale = scale;
+    cache.clipRect = clip_rect;
+    cache.blink = m_blink;
+    cache.fonts[0] = m_defaultFont;
+    cache.fonts[1] = m_boldFont;
+    cache.fonts[2] = m_italicFont;
+    cache.fonts[3] = m_boldItalicFont;
+    cache.texId = drawList->CmdBuffer[drawList->CmdBuffer.Size - 1].TextureId;
+    cache.whitePixel = drawList->_Data->TexUvWhitePixel;
+    cache.vtx.resize((int)(vtx_write - vtx_start));
+    memcpy(cache.vtx.Data, vtx_start, cache.vtx.Size * sizeof(ImDrawVert));
+    cache.idx.resize((int)(idx_write - idx_start));
+    for (int i = 0; i < cache.idx.Size; i++)
+        cache.idx[i] = (ImDrawIdx)(idx_start[i] - vtx_start_idx);
 }
 
 void ImGuiTerminal::Draw(const ImVec4 &contentArea, float scale)
@@ -1088,22 +1372,27 @@ void ImGuiTerminal::Draw(const ImVec4 &contentArea, float scale)
     //bool hasFocus = true; //ImGui::IsItemFocused();
     bool hasFocus = ImGui::IsWindowFocused();
 
-    bool modeFocus = m_mode & MODE_FOCUSED;
-    if (hasFocus != modeFocus)
     {
-        if (hasFocus)
+        std::lock_guard<std::mutex> lock(m_terminal->GetLock());
+        bool modeFocus = m_mode & MODE_FOCUSED;
+        if (hasFocus != modeFocus)
         {
-            m_mode |= MODE_FOCUSED | MODE_FOCUS;
+            if (hasFocus)
+            {
+                m_mode |= MODE_FOCUSED | MODE_FOCUS;
+            }
+            else
+            {
+                m_mode ^= MODE_FOCUS | MODE_FOCUSED;
+            }
+            /* the cursor changes shape, the emulator has no damage of its own to draw it with */
+            m_terminal->Redraw();
         }
         else
         {
-            m_mode ^= MODE_FOCUS | MODE_FOCUSED;
+            m_mode ^= MODE_FOCUS;
         }
     }
-    else
-    {
-        m_mode ^= MODE_FOCUS;
-    }
 
     auto *drawList = ImGui::GetWindowDrawList();
     Draw(drawList, ImVec2(contentArea.x, contentArea.y), scale, contentArea, hasFocus);
@@ -1146,11 +1435,54 @@ std::shared_ptr<ImGuiTerminal> ImGuiTerminal::Create(int columns, int rows, cons
         return nullptr;
     }
 
-    std::shared_ptr<ImGuiTerminal> terminal = std::shared_ptr<ImGuiTerminal>(new ImGuiTerminal(columns, rows, &config));
+    auto terminal = Allocate(columns, rows, &config);
     terminal->m_terminal = TerminalEmulator::Create(std::move(pseudoTerminal), std::move(process), terminal);
+    if (terminal->m_terminal)
+        terminal->StartThreads(options);
+    return terminal;
+}
+
+std::shared_ptr<ImGuiTerminal> ImGuiTerminal::CreateAsync(int columns, int rows, const std::string &program, const ImVector<std::string> &args, const std::string &workingDir, uint32_t options, System::IProcessFactory *processFactory)
+{
+    ImGuiTerminalConfig config{};
+    config.options = options;
+
+    if (processFactory == nullptr)
+    {
+        processFactory = g_processFactory;
+    }
+
+    auto terminal = Allocate(columns, rows, &config);
+    terminal->m_terminal = TerminalEmulator::Create(columns, rows, terminal);
+    if (!terminal->m_terminal)
+        return nullptr;
+
+    std::vector<std::string> argsV(args.begin(), args.end());
+    terminal->m_spawnOptions = options;
+    terminal->m_spawn = processFactory->CreateWithPseudoTerminalAsync(program, argsV, workingDir, columns, rows);
     return terminal;
 }
 
+std::shared_ptr<ImGuiTerminal> ImGuiTerminal::Allocate(int columns, int rows, ImGuiTerminalConfig *config)
+{
+    // The parser thread holds the terminal while it draws, and drops the last reference when everybody else let go
+    // in the meantime. The terminal owns the emulator and joins that thread, so it is destroyed on another one.
+    return std::shared_ptr<ImGuiTerminal>(new ImGuiTerminal(columns, rows, config), [](ImGuiTerminal *t) {
+        if (t->m_terminal && t->m_terminal->IsParserThread())
+            std::thread([t] { delete t; }).detach();
+        else
+            delete t;
+    });
+}
+
+void ImGuiTerminal::StartThreads(uint32_t options)
+{
+    if (options & OPTION_PARSER_THREAD)
+        m_terminal->StartParser();
+    else if (options & OPTION_READER_THREAD)
+        m_terminal->StartReader();
+}
+
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
\ No newline at end of file
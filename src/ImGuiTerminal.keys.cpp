@@ -48,7 +48,10 @@ ImGuiKeyMap::ImGuiKeyMap(const Key keys[], size_t keysLen, const Key platformKey
 using ShortcutAction = Hexe::Terminal::ShortcutAction;
 
 static Shortcut shortcuts[] = {
-    {ImGuiKey_Insert, ImGuiKeyModFlags_Shift, ShortcutAction::PASTE, 0, 0}};
+    {ImGuiKey_Insert, ImGuiKeyModFlags_Shift, ShortcutAction::PASTE, 0, 0},
+    {ImGuiKey_Escape, ImGuiKeyModFlags_Shift, ShortcutAction::CANCEL_PASTE, 0, 0},
+    {ImGuiKey_PageUp, ImGuiKeyModFlags_Shift, ShortcutAction::SCROLL_UP, 0, 0},
+    {ImGuiKey_PageDown, ImGuiKeyModFlags_Shift, ShortcutAction::SCROLL_DOWN, 0, 0}};
 
 static Key keys[] = {
     /* keysym           mask            string      appkey appcursor */
@@ -0,0 +1,313 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+#ifndef WIN32
+#include "Hexe/Terminal/ParserPool.h"
+#include "Hexe/Terminal/TerminalEmulator.h"
+#include <deque>
+#include <errno.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace Hexe::Terminal;
+
+/*
+ * Each pty is in the epoll set with EPOLLONESHOT, so it is reported once and
+ * then left alone until the batch it was queued for is done. A batch that
+ * used up its budget queues the session again on its own worker instead of
+ * going back through the poller, behind the sessions already waiting there.
+ * Idle workers steal from the other end of the other queues.
+ */
+struct ParserPool::Session
+{
+    TerminalEmulator *terminal;
+    uint64_t id;
+    int fd;
+    bool readable; /* the batch has output to read, not only a hangup */
+    bool busy;     /* queued or being parsed, so not armed in the epoll set */
+    bool removed;
+};
+
+struct ParserPool::Worker
+{
+    std::thread thread;
+    std::mutex lock;
+    std::deque<Session *> queue;
+};
+
+static thread_local const TerminalEmulator *g_current = nullptr;
+
+ParserPool::ParserPool(AutoHandle &&epoll, AutoHandle &&wake, int threads)
+    : m_epoll(std::move(epoll)), m_wake(std::move(wake)), m_nextId(1), m_nextWorker(0), m_queued(0), m_stop(false)
+{
+    for (int i = 0; i < threads; i++)
+        m_workers.emplace_back(new Worker());
+    for (size_t i = 0; i < m_workers.size(); i++)
+        m_workers[i]->thread = std::thread(&ParserPool::Work, this, i);
+    m_poller = std::thread(&ParserPool::Poll, this);
+}
+
+ParserPool::~ParserPool()
+{
+    uint64_t one = 1;
+
+    m_stop = true;
+    while (write((int)m_wake, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+    m_poller.join();
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        m_work.notify_all();
+    }
+    for (auto &w : m_workers)
+        w->thread.join();
+
+    for (auto &s : m_sessions)
+        s.second->terminal->m_pool = nullptr;
+}
+
+bool ParserPool::Add(TerminalEmulator &terminal)
+{
+    struct epoll_event ev = {};
+    int fd;
+
+    if (terminal.m_pool || terminal.m_reactor || terminal.m_reader || !terminal.m_pty)
+        return false;
+    if ((fd = terminal.m_pty->GetPollFd()) < 0)
+        return false;
+
+    std::lock_guard<std::mutex> lk(m_lock);
+    std::unique_ptr<Session> s(new Session{&terminal, m_nextId++, fd, false, false, false});
+
+    /* set before the first batch can run, which may be right away */
+    terminal.m_pool = this;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.u64 = s->id;
+    if (epoll_ctl((int)m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        perror("ParserPool::Add(epoll_ctl)");
+        terminal.m_pool = nullptr;
+        return false;
+    }
+    m_sessions.emplace(s->id, std::move(s));
+    return true;
+}
+
+void ParserPool::Remove(TerminalEmulator &terminal)
+{
+    std::unique_lock<std::mutex> lk(m_lock);
+    auto it = m_sessions.begin();
+    while (it != m_sessions.end() && it->second->terminal != &terminal)
+        ++it;
+    if (it == m_sessions.end())
+        return;
+
+    Session *s = it->second.get();
+    s->removed = true;
+    /* a queued session is dropped by the worker that pops it */
+    while (s->busy)
+        m_done.wait(lk);
+
+    /* fails when it was taken out on hangup already */
+    epoll_ctl((int)m_epoll, EPOLL_CTL_DEL, s->fd, nullptr);
+    terminal.m_pool = nullptr;
+    m_sessions.erase(it);
+}
+
+const TerminalEmulator *ParserPool::GetCurrent()
+{
+    return g_current;
+}
+
+void ParserPool::Poll()
+{
+    struct epoll_event evs[64];
+    int i, n;
+
+    while (!m_stop)
+    {
+        n = epoll_wait((int)m_epoll, evs, (int)(sizeof(evs) / sizeof(evs[0])), -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("ParserPool::Poll(epoll_wait)");
+            break;
+        }
+
+        std::lock_guard<std::mutex> lk(m_lock);
+        for (i = 0; i < n; i++)
+        {
+            /* the session may have been removed since epoll_wait() returned it */
+            auto it = m_sessions.find(evs[i].data.u64);
+            if (it == m_sessions.end() || it->second->removed)
+                continue;
+
+            Session *s = it->second.get();
+            s->readable = (evs[i].events & EPOLLIN) != 0;
+            s->busy = true;
+            Push(m_nextWorker++ % m_workers.size(), s);
+        }
+    }
+}
+
+/* called with m_lock held, which keeps m_queued in step with the waiting workers */
+void ParserPool::Push(size_t worker, Session *s)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_workers[worker]->lock);
+        m_workers[worker]->queue.push_back(s);
+    }
+    m_queued++;
+    m_work.notify_one();
+}
+
+ParserPool::Session *ParserPool::Pop(size_t self)
+{
+    size_t i, n = m_workers.size();
+    Session *s = nullptr;
+
+    /* the own queue from the front, the others from the back */
+    for (i = 0; i < n && !s; i++)
+    {
+        Worker *w = m_workers[(self + i) % n].get();
+        std::lock_guard<std::mutex> lk(w->lock);
+        if (w->queue.empty())
+            continue;
+        if (i == 0)
+        {
+            s = w->queue.front();
+            w->queue.pop_front();
+        }
+        else
+        {
+            s = w->queue.back();
+            w->queue.pop_back();
+        }
+    }
+    if (s)
+        m_queued--;
+    return s;
+}
+
+void ParserPool::Work(size_t self)
+{
+    Session *s;
+
+    /* sessions that are still queued are left there, they don't outlive the pool */
+    while (!m_stop)
+    {
+        if ((s = Pop(self)))
+        {
+            Run(self, s);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lk(m_lock);
+        while (!m_stop && m_queued == 0)
+            m_work.wait(lk);
+    }
+}
+
+void ParserPool::Run(size_t self, Session *s)
+{
+    struct epoll_event ev = {};
+    bool removed;
+    int more = 0;
+
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        removed = s->removed;
+    }
+    if (!removed)
+    {
+        g_current = s->terminal;
+        more = s->terminal->ttybatch(s->readable);
+        g_current = nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        if (!s->removed && more > 0)
+        {
+            s->readable = true;
+            Push(self, s);
+        }
+        else
+        {
+            s->busy = false;
+            m_done.notify_all();
+        }
+        if (!s->removed && more == 0)
+        {
+            ev.events = EPOLLIN | EPOLLONESHOT;
+            ev.data.u64 = s->id;
+            if (epoll_ctl((int)m_epoll, EPOLL_CTL_MOD, s->fd, &ev) != 0)
+                perror("ParserPool::Run(epoll_ctl)");
+        }
+    }
+
+    /*
+     * A mutex doesn't queue its waiters, so without this a flood would take
+     * the emulator lock for the next batch before a thread that waits for it
+     * to handle input ever gets it.
+     */
+    if (more > 0)
+        std::this_thread::yield();
+}
+
+std::unique_ptr<ParserPool> ParserPool::Create(int threads)
+{
+    struct epoll_event ev = {};
+
+    if (threads <= 0)
+        threads = (int)std::thread::hardware_concurrency();
+    if (threads <= 0)
+        threads = 1;
+
+    AutoHandle epoll(epoll_create1(EPOLL_CLOEXEC));
+    if (!epoll)
+    {
+        perror("ParserPool::Create(epoll_create1)");
+        return nullptr;
+    }
+    AutoHandle wake(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    if (!wake)
+    {
+        perror("ParserPool::Create(eventfd)");
+        return nullptr;
+    }
+
+    /* session ids start at 1, so 0 is the wake eventfd */
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;
+    if (epoll_ctl((int)epoll, EPOLL_CTL_ADD, (int)wake, &ev) != 0)
+    {
+        perror("ParserPool::Create(epoll_ctl)");
+        return nullptr;
+    }
+
+    return std::unique_ptr<ParserPool>(new ParserPool(std::move(epoll), std::move(wake), threads));
+}
+
+#endif
@@ -0,0 +1,47 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+#ifdef WIN32
+#include "Hexe/Terminal/ParserPool.h"
+#include "Hexe/Terminal/TerminalEmulator.h"
+
+using namespace Hexe::Terminal;
+
+/*
+ * Like TerminalReactor, the pool needs the pseudoterminals in one wait set,
+ * which ConPTY pipes don't allow. Create() fails, emulators parse with
+ * StartParser() instead.
+ */
+ParserPool::ParserPool(AutoHandle &&epoll, AutoHandle &&wake, int threads)
+    : m_epoll(std::move(epoll)), m_wake(std::move(wake)), m_nextId(1), m_nextWorker(0), m_queued(0), m_stop(false)
+{
+}
+
+ParserPool::~ParserPool() {}
+
+bool ParserPool::Add(TerminalEmulator &terminal) { return false; }
+
+void ParserPool::Remove(TerminalEmulator &terminal) {}
+
+const TerminalEmulator *ParserPool::GetCurrent() { return nullptr; }
+
+std::unique_ptr<ParserPool> ParserPool::Create(int threads) { return nullptr; }
+#endif
@@ -0,0 +1,219 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+#ifndef WIN32
+// Windows has its own source file
+#include "Hexe/System/Pipe.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace Hexe::System;
+
+/*
+ * Both ends are non-blocking, like the pty master. A log set with Tee() is
+ * written without the output passing through user space twice: Read()
+ * tee()s what the pipe holds into a second pipe, splices that on to the
+ * log, and then reads only as much as was logged, so the log and what
+ * Read() returns never drift apart.
+ */
+Pipe::Pipe(AutoHandle &&readHandle, AutoHandle &&writeHandle,
+           AutoHandle &&wakeRead, AutoHandle &&wakeWrite)
+    : m_hInput(std::move(readHandle)), m_hOutput(std::move(writeHandle)),
+      m_wakeRead(std::move(wakeRead)), m_wakeWrite(std::move(wakeWrite)) {}
+
+bool Pipe::IsTTY() const { return false; }
+
+int Pipe::Write(const char *s, size_t n) {
+  sigset_t sigpipe, oldmask, pending;
+  size_t c = 0;
+  int ret;
+
+  /* a child that closed its stdin fails the write with EPIPE, and must not
+   * kill us with SIGPIPE on top of that */
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  sigpending(&pending);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, &oldmask);
+
+  for (;;) {
+    if (c == n) {
+      ret = (int)c;
+      break;
+    }
+    ssize_t r = write((int)m_hOutput, s + c, n - c);
+    if (r >= 0) {
+      c += r;
+      continue;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN) {
+      ret = (int)c;
+      break;
+    }
+    if (errno == EPIPE && !sigismember(&pending, SIGPIPE)) {
+      struct timespec zero = {0, 0};
+      sigtimedwait(&sigpipe, nullptr, &zero);
+      errno = EPIPE;
+    }
+    ret = -1;
+    break;
+  }
+
+  int err = errno;
+  pthread_sigmask(SIG_SETMASK, &oldmask, nullptr);
+  errno = err;
+  return ret;
+}
+
+int Pipe::Read(char *s, size_t n, bool block) {
+  struct pollfd pfd[2];
+  pfd[0].fd = (int)m_hInput;
+  pfd[0].events = POLLIN;
+  pfd[0].revents = 0;
+  /* the wake pipe is never drained, so an interrupt sticks */
+  pfd[1].fd = (int)m_wakeRead;
+  pfd[1].events = POLLIN;
+  pfd[1].revents = 0;
+  /* at end of file only POLLHUP is set, a blocking read returns 0 then */
+  short ready = block ? (POLLIN | POLLHUP | POLLERR) : POLLIN;
+
+  for (;;) {
+    auto i = poll(pfd, 2, block ? -1 : 0);
+    if (i < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("Pipe::Read(poll)");
+      return -1;
+    }
+    if (pfd[1].revents & POLLIN)
+      return 0;
+    if (i == 0 || !(pfd[0].revents & ready)) {
+      if (block)
+        continue;
+      return 0;
+    }
+    if (m_log) {
+      ssize_t t = tee((int)m_hInput, (int)m_logWrite, n, SPLICE_F_NONBLOCK);
+      if (t == 0)
+        return 0;
+      if (t < 0 && errno == EAGAIN) {
+        if (block)
+          continue;
+        return 0;
+      }
+      if (t < 0 || !LogSpliced((size_t)t)) {
+        perror("Pipe::Read(tee)");
+        m_log.Release();
+        m_logRead.Release();
+        m_logWrite.Release();
+      } else {
+        n = (size_t)t;
+      }
+    }
+    ssize_t r = read((int)m_hInput, s, n);
+    /* another reader may have taken what poll() saw */
+    if (r < 0 && errno == EAGAIN) {
+      if (block)
+        continue;
+      return 0;
+    }
+    return (int)r;
+  }
+}
+
+/* copies up to n bytes through user space, returns the nb copied or -1 */
+static ssize_t copyfd(int from, int to, size_t n) {
+  char buf[4096];
+  ssize_t r, w;
+
+  r = read(from, buf, n < sizeof(buf) ? n : sizeof(buf));
+  for (ssize_t c = 0; r > 0 && c < r; c += w) {
+    if ((w = write(to, buf + c, r - c)) < 0) {
+      if (errno != EINTR)
+        return -1;
+      w = 0;
+    }
+  }
+  return r;
+}
+
+/* moves the n bytes tee()d into the log pipe on to the log */
+bool Pipe::LogSpliced(size_t n) {
+  while (n > 0) {
+    ssize_t r = splice((int)m_logRead, nullptr, (int)m_log, nullptr, n,
+                       SPLICE_F_MOVE);
+    /* a log opened with O_APPEND can't be spliced to, it is copied then */
+    if (r < 0 && errno == EINVAL)
+      r = copyfd((int)m_logRead, (int)m_log, n);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return false;
+    n -= r;
+  }
+  return true;
+}
+
+void Pipe::Interrupt() {
+  char c = 0;
+  ssize_t r;
+
+  do {
+    r = write((int)m_wakeWrite, &c, 1);
+  } while (r < 0 && errno == EINTR);
+}
+
+int Pipe::GetPollFd() const { return (int)m_hInput; }
+
+size_t Pipe::GetPending() const {
+  int n = 0;
+
+  if (ioctl((int)m_hInput, FIONREAD, &n) < 0 || n < 0)
+    return 0;
+  return (size_t)n;
+}
+
+bool Pipe::Tee(int fd) {
+  int logPipe[2];
+
+  AutoHandle log(fcntl(fd, F_DUPFD_CLOEXEC, 0));
+  if (!log) {
+    perror("Pipe::Tee(fcntl)");
+    return false;
+  }
+  if (pipe2(logPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+    perror("Pipe::Tee(pipe2)");
+    return false;
+  }
+  m_log = std::move(log);
+  m_logRead = AutoHandle(logPipe[0]);
+  m_logWrite = AutoHandle(logPipe[1]);
+  return true;
+}
+
+#endif
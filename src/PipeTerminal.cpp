@@ -0,0 +1,131 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+#include "Hexe/Terminal/PipeTerminal.h"
+#include <stdio.h>
+
+using namespace Hexe::Terminal;
+
+PipeTerminal::PipeTerminal(std::unique_ptr<System::IPipe> &&pipe, int columns, int rows)
+    : m_pipe(std::move(pipe)), m_columns(columns), m_rows(rows), m_newline(false)
+{
+}
+
+bool PipeTerminal::IsTTY() const
+{
+    return false;
+}
+
+int PipeTerminal::GetNumColumns() const
+{
+    return m_columns;
+}
+
+int PipeTerminal::GetNumRows() const
+{
+    return m_rows;
+}
+
+bool PipeTerminal::Resize(int columns, int rows)
+{
+    m_columns = columns;
+    m_rows = rows;
+    return true;
+}
+
+/* ICRNL, the count stays the same */
+int PipeTerminal::Write(const char *s, size_t n)
+{
+    m_input.assign(s, n);
+    for (auto &c : m_input)
+    {
+        if (c == '\r')
+            c = '\n';
+    }
+    return m_pipe->Write(m_input.data(), m_input.size());
+}
+
+/* ONLCR, half of buf is read so every newline has room for its carriage return */
+int PipeTerminal::Read(char *buf, size_t n, bool block)
+{
+    size_t i, j, lines = 0;
+    int r;
+
+    if (n == 0)
+        return 0;
+    if (m_newline)
+    {
+        m_newline = false;
+        buf[0] = '\n';
+        return 1;
+    }
+
+    if ((r = m_pipe->Read(buf, n > 1 ? n / 2 : 1, block)) <= 0)
+        return r;
+
+    for (i = 0; i < (size_t)r; i++)
+        lines += buf[i] == '\n';
+    if (r + lines > n)
+    {
+        /* a lone newline read into a single byte */
+        buf[0] = '\r';
+        m_newline = true;
+        return 1;
+    }
+
+    for (i = r, j = r + lines; i > 0;)
+    {
+        buf[--j] = buf[--i];
+        if (buf[i] == '\n')
+            buf[--j] = '\r';
+    }
+    return (int)(r + lines);
+}
+
+void PipeTerminal::Interrupt()
+{
+    m_pipe->Interrupt();
+}
+
+int PipeTerminal::GetPollFd() const
+{
+    return m_pipe->GetPollFd();
+}
+
+size_t PipeTerminal::GetPending() const
+{
+    return m_pipe->GetPending() + m_newline;
+}
+
+bool PipeTerminal::Tee(int fd)
+{
+    return m_pipe->Tee(fd);
+}
+
+std::unique_ptr<PipeTerminal> PipeTerminal::Create(std::unique_ptr<System::IPipe> &&pipe, int columns, int rows)
+{
+    if (!pipe)
+    {
+        fprintf(stderr, "Must provide a valid pipe\n");
+        return nullptr;
+    }
+    return std::unique_ptr<PipeTerminal>(new PipeTerminal(std::move(pipe), columns, rows));
+}
@@ -0,0 +1,221 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+#include "Hexe/System/PooledProcessFactory.h"
+#include "Hexe/System/ProcessFactory.h"
+#include <algorithm>
+#include <stdio.h>
+
+using namespace Hexe::System;
+
+/*
+ * The helper thread starts shells with the wrapped factory, outside the
+ * lock, until as many are warm as the recent demand asks for, and then
+ * sleeps until one is handed out. It wakes up once per demand window as
+ * well, to drop the shells that exited and those the demand no longer
+ * asks for, so a burst of new sessions doesn't keep a crowd of shells
+ * around for good.
+ */
+static const std::chrono::seconds s_demandwindow(60);
+static const std::chrono::seconds s_retrydelay(1);
+
+PooledProcessFactory::PooledProcessFactory(std::unique_ptr<IProcessFactory> &&factory,
+                                           const std::string &program,
+                                           const std::vector<std::string> &args,
+                                           const std::string &workingDirectory,
+                                           size_t minWarm, size_t maxWarm,
+                                           int numColumns, int numRows)
+    : m_factory(std::move(factory)), m_program(program), m_args(args), m_workingDirectory(workingDirectory), m_numColumns(numColumns), m_numRows(numRows), m_minWarm(minWarm), m_maxWarm(std::max(minWarm, maxWarm)), m_hits(0), m_misses(0), m_stop(false)
+{
+    if (!m_factory)
+        m_factory.reset(new ProcessFactory());
+    m_thread = std::thread(&PooledProcessFactory::Fill, this);
+}
+
+PooledProcessFactory::~PooledProcessFactory()
+{
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+std::unique_ptr<IProcess>
+PooledProcessFactory::CreateWithStdioPipe(const std::string &program,
+                                          const std::vector<std::string> &args,
+                                          const std::string &workingDirectory,
+                                          std::unique_ptr<IPipe> &outPipe,
+                                          bool withStderr)
+{
+    return m_factory->CreateWithStdioPipe(program, args, workingDirectory, outPipe, withStderr);
+}
+
+std::unique_ptr<IProcess>
+PooledProcessFactory::CreateWithPseudoTerminal(const std::string &program,
+                                               const std::vector<std::string> &args,
+                                               const std::string &workingDirectory,
+                                               int numColumns, int numRows,
+                                               std::unique_ptr<Hexe::Terminal::IPseudoTerminal> &outPseudoTerminal)
+{
+    PseudoTerminalProcess warm;
+
+    if (Pooled(program, args, workingDirectory) && Take(numColumns, numRows, warm))
+    {
+        outPseudoTerminal = std::move(warm.pseudoTerminal);
+        return std::move(warm.process);
+    }
+    return m_factory->CreateWithPseudoTerminal(program, args, workingDirectory, numColumns, numRows, outPseudoTerminal);
+}
+
+std::future<PseudoTerminalProcess>
+PooledProcessFactory::CreateWithPseudoTerminalAsync(const std::string &program,
+                                                    const std::vector<std::string> &args,
+                                                    const std::string &workingDirectory,
+                                                    int numColumns, int numRows)
+{
+    PseudoTerminalProcess warm;
+
+    if (Pooled(program, args, workingDirectory) && Take(numColumns, numRows, warm))
+    {
+        std::promise<PseudoTerminalProcess> ready;
+        ready.set_value(std::move(warm));
+        return ready.get_future();
+    }
+    return m_factory->CreateWithPseudoTerminalAsync(program, args, workingDirectory, numColumns, numRows);
+}
+
+size_t PooledProcessFactory::GetNumWarm()
+{
+    std::lock_guard<std::mutex> lk(m_lock);
+    return m_warm.size();
+}
+
+size_t PooledProcessFactory::GetHits()
+{
+    std::lock_guard<std::mutex> lk(m_lock);
+    return m_hits;
+}
+
+size_t PooledProcessFactory::GetMisses()
+{
+    std::lock_guard<std::mutex> lk(m_lock);
+    return m_misses;
+}
+
+bool PooledProcessFactory::Pooled(const std::string &program, const std::vector<std::string> &args, const std::string &workingDirectory) const
+{
+    return program == m_program && args == m_args && workingDirectory == m_workingDirectory;
+}
+
+/* hands out the oldest warm shell that is still running, resized to the session */
+bool PooledProcessFactory::Take(int numColumns, int numRows, PseudoTerminalProcess &out)
+{
+    std::deque<PseudoTerminalProcess> exited;
+    std::unique_lock<std::mutex> lk(m_lock);
+
+    m_demand.push_back(Clock::now());
+    while (!m_warm.empty())
+    {
+        auto warm = std::move(m_warm.front());
+        m_warm.pop_front();
+
+        warm.process->CheckExitStatus();
+        if (warm.process->HasExited())
+        {
+            exited.push_back(std::move(warm));
+            continue;
+        }
+        out = std::move(warm);
+        break;
+    }
+    (out.process ? m_hits : m_misses)++;
+    lk.unlock();
+    m_wake.notify_one();
+
+    if (out.process && !out.pseudoTerminal->Resize(numColumns, numRows))
+    {
+        fprintf(stderr, "Failed to resize pooled pseudo terminal\n");
+        out = PseudoTerminalProcess();
+        return false;
+    }
+    return (bool)out.process;
+}
+
+/* as many as were asked for over the demand window, within the bounds */
+size_t PooledProcessFactory::Target(Clock::time_point now)
+{
+    while (!m_demand.empty() && now - m_demand.front() > s_demandwindow)
+        m_demand.pop_front();
+    return std::min(m_maxWarm, std::max(m_minWarm, m_demand.size()));
+}
+
+void PooledProcessFactory::Fill()
+{
+    std::unique_lock<std::mutex> lk(m_lock);
+
+    while (!m_stop)
+    {
+        std::deque<PseudoTerminalProcess> dropped;
+        size_t target = Target(Clock::now());
+
+        for (auto it = m_warm.begin(); it != m_warm.end();)
+        {
+            it->process->CheckExitStatus();
+            if (it->process->HasExited())
+            {
+                dropped.push_back(std::move(*it));
+                it = m_warm.erase(it);
+            }
+            else
+                ++it;
+        }
+        while (m_warm.size() > target)
+        {
+            dropped.push_back(std::move(m_warm.back()));
+            m_warm.pop_back();
+        }
+
+        if (m_warm.size() == target)
+        {
+            /* the dropped shells are hung up outside the lock, where a Take() may have come and gone */
+            lk.unlock();
+            dropped.clear();
+            lk.lock();
+            m_wake.wait_for(lk, s_demandwindow, [this] {
+                return m_stop || m_warm.size() < Target(Clock::now());
+            });
+            continue;
+        }
+
+        lk.unlock();
+        dropped.clear();
+        PseudoTerminalProcess warm;
+        warm.process = m_factory->CreateWithPseudoTerminal(m_program, m_args, m_workingDirectory, m_numColumns, m_numRows, warm.pseudoTerminal);
+        lk.lock();
+
+        if (warm.process && warm.pseudoTerminal)
+            m_warm.push_back(std::move(warm));
+        else if (!m_stop)
+            m_wake.wait_for(lk, s_retrydelay);
+    }
+}
@@ -22,6 +22,9 @@
 
 #ifndef WIN32
 #include "Hexe/System/Process.h"
+#include "Hexe/System/Pipe.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <pwd.h>
 #include <signal.h>
@@ -30,17 +33,30 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <utility>
 
 #define DEFAULT(a, b) (a) = (a) ? (a) : (b)
 
 #if defined(__linux)
+#include <dirent.h>
 #include <pty.h>
+#include <sys/syscall.h>
 #elif defined(__OpenBSD__) || defined(__NetBSD__) || defined(__APPLE__)
 #include <util.h>
 #elif defined(__FreeBSD__) || defined(__DragonFly__)
 #include <libutil.h>
 #endif
 
+/* glibc spawns with clone(CLONE_VM | CLONE_VFORK), and can close descriptors in the child */
+#if defined(__linux) && defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 34)
+#define HEXE_POSIX_SPAWN
+#include <spawn.h>
+#endif
+#endif
+
+extern char **environ;
+
 using namespace Hexe::System;
 
 Process::~Process() {
@@ -98,50 +114,271 @@ int Process::GetExitCode() const {
   return m_status == ProcessStatus::EXITED ? m_exitCode : 255;
 }
 
-Process::Process(int pid) : m_pid(pid) {}
+int Process::GetPollFd() const { return (int)m_pidfd; }
+
+Process::Process(int pid)
+    : m_status(ProcessStatus::RUNNING), m_leaveRunning(false), m_exitCode(1),
+      m_pid(pid) {
+#if defined(__linux) && defined(SYS_pidfd_open)
+  /* ENOSYS before Linux 5.3, the exit status is polled then */
+  m_pidfd = AutoHandle((int)syscall(SYS_pidfd_open, pid, 0));
+#endif
+}
+
+using ShellVars = std::vector<std::pair<std::string, std::string>>;
+
+static const char *const s_unsetvars[] = {"COLUMNS", "LINES", "TERMCAP"};
+static const int s_defaultsignals[] = {SIGCHLD, SIGHUP,  SIGINT,
+                                       SIGQUIT, SIGTERM, SIGALRM};
 
-static void execshell(const char *cmd, const char *const *args) {
-  char *sh, *prog, *arg;
-  const struct passwd *pw;
+/* the variables set for the shell, looked up before the child is started,
+ * possibly on several threads at once */
+static bool shellvars(ShellVars &vars) {
+  struct passwd pwbuf, *pw;
+  std::vector<char> buf(16384);
+  const char *sh;
+  int err;
 
-  errno = 0;
-  if ((pw = getpwuid(getuid())) == NULL) {
-    if (errno) {
-      fprintf(stderr, "getpwuid: %s\n", strerror(errno));
-      _exit(1);
-    } else {
+  if ((err = getpwuid_r(getuid(), &pwbuf, buf.data(), buf.size(), &pw)) != 0 ||
+      pw == NULL) {
+    if (err)
+      fprintf(stderr, "getpwuid: %s\n", strerror(err));
+    else
       fprintf(stderr, "who are you?\n");
-      _exit(1);
-    }
+    return false;
   }
 
-  unsetenv("COLUMNS");
-  unsetenv("LINES");
-  unsetenv("TERMCAP");
-  setenv("LOGNAME", pw->pw_name, 1);
-  setenv("USER", pw->pw_name, 1);
-  setenv("SHELL", sh, 1);
-  setenv("HOME", pw->pw_dir, 1);
-  setenv("TERM", "st-256color", 1);
+  if ((sh = getenv("SHELL")) == NULL)
+    sh = (pw->pw_shell[0]) ? pw->pw_shell : "/bin/sh";
+
+  vars = {{"LOGNAME", pw->pw_name}, {"USER", pw->pw_name}, {"SHELL", sh},
+          {"HOME", pw->pw_dir},     {"TERM", "st-256color"}};
+  return true;
+}
 
-  signal(SIGCHLD, SIG_DFL);
-  signal(SIGHUP, SIG_DFL);
-  signal(SIGINT, SIG_DFL);
-  signal(SIGQUIT, SIG_DFL);
-  signal(SIGTERM, SIG_DFL);
-  signal(SIGALRM, SIG_DFL);
+static void execshell(const char *cmd, const char *const *args,
+                      const ShellVars &vars) {
+  for (auto name : s_unsetvars)
+    unsetenv(name);
+  for (auto &v : vars)
+    setenv(v.first.c_str(), v.second.c_str(), 1);
+
+  for (auto sig : s_defaultsignals)
+    signal(sig, SIG_DFL);
 
   execvp(cmd, (char *const *)args);
   _exit(1);
 }
 
+/* closes every descriptor from fd on, in the child after fork() */
+static void closefds(int fd) {
+#if defined(__linux) && defined(SYS_close_range)
+  if (syscall(SYS_close_range, (unsigned)fd, ~0U, 0) == 0)
+    return;
+#endif
+#if defined(__linux)
+  /* only the open ones, not every one up to the nofile limit */
+  DIR *dir = opendir("/proc/self/fd");
+  if (dir) {
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+      int i = atoi(e->d_name);
+      if (i >= fd && i != dirfd(dir))
+        close(i);
+    }
+    closedir(dir);
+    return;
+  }
+#endif
+  int fdlimit = (int)sysconf(_SC_OPEN_MAX);
+  for (int i = fd; i < fdlimit; i++)
+    close(i);
+}
+
+#ifdef HEXE_POSIX_SPAWN
+/*
+ * Starts the shell without copying our page tables, which fork() does for
+ * the whole GUI process. The child starts a session and opens the slave,
+ * which makes it the controlling terminal, like TIOCSCTTY after fork().
+ * Returns 0 or an errno value.
+ */
+static int spawnshell(const char *cmd, const char *const *args,
+                      const ShellVars &vars, int slave, pid_t *pid) {
+  posix_spawn_file_actions_t fa;
+  posix_spawnattr_t attr;
+  sigset_t sigdefault, sigmask;
+  std::vector<std::string> env;
+  std::vector<char *> envp;
+  char tty[64];
+  int err;
+
+  if ((err = ttyname_r(slave, tty, sizeof(tty))) != 0)
+    return err;
+
+  for (char **e = environ; *e; e++) {
+    const char *eq = strchr(*e, '=');
+    size_t len = eq ? (size_t)(eq - *e) : strlen(*e);
+    bool skip = false;
+    for (auto name : s_unsetvars)
+      skip = skip || (strlen(name) == len && !strncmp(*e, name, len));
+    for (auto &v : vars)
+      skip = skip || (v.first.size() == len && !strncmp(*e, v.first.c_str(), len));
+    if (!skip)
+      env.push_back(*e);
+  }
+  for (auto &v : vars)
+    env.push_back(v.first + "=" + v.second);
+  for (auto &e : env)
+    envp.push_back(&e[0]);
+  envp.push_back(nullptr);
+
+  sigemptyset(&sigdefault);
+  for (auto sig : s_defaultsignals)
+    sigaddset(&sigdefault, sig);
+  sigemptyset(&sigmask);
+
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_addopen(&fa, 0, tty, O_RDWR, 0);
+  posix_spawn_file_actions_adddup2(&fa, 0, 1);
+  posix_spawn_file_actions_adddup2(&fa, 0, 2);
+  posix_spawn_file_actions_addclosefrom_np(&fa, 3);
+
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGDEF |
+                                      POSIX_SPAWN_SETSIGMASK);
+  posix_spawnattr_setsigdefault(&attr, &sigdefault);
+  posix_spawnattr_setsigmask(&attr, &sigmask);
+
+  err = posix_spawnp(pid, cmd, &fa, &attr, (char *const *)args, envp.data());
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&fa);
+  return err;
+}
+#endif
+
+/*
+ * Starts a program with stdin and stdout (and stderr) on pipes, in a
+ * process group of its own, so it isn't sent signals meant for ours.
+ * Without withStderr it writes its errors to our stderr. Returns 0 or an
+ * errno value.
+ */
+static int spawnpipe(const char *cmd, const char *const *args,
+                     const std::string &workingDirectory, int in, int out,
+                     bool withStderr, pid_t *pid) {
+#ifdef HEXE_POSIX_SPAWN
+  posix_spawn_file_actions_t fa;
+  posix_spawnattr_t attr;
+  sigset_t sigdefault, sigmask;
+  int err;
+
+  sigemptyset(&sigdefault);
+  for (auto sig : s_defaultsignals)
+    sigaddset(&sigdefault, sig);
+  sigaddset(&sigdefault, SIGPIPE);
+  sigemptyset(&sigmask);
+
+  posix_spawn_file_actions_init(&fa);
+  if (!workingDirectory.empty())
+    posix_spawn_file_actions_addchdir_np(&fa, workingDirectory.c_str());
+  posix_spawn_file_actions_adddup2(&fa, in, 0);
+  posix_spawn_file_actions_adddup2(&fa, out, 1);
+  if (withStderr)
+    posix_spawn_file_actions_adddup2(&fa, out, 2);
+  posix_spawn_file_actions_addclosefrom_np(&fa, 3);
+
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+                                      POSIX_SPAWN_SETSIGDEF |
+                                      POSIX_SPAWN_SETSIGMASK);
+  posix_spawnattr_setpgroup(&attr, 0);
+  posix_spawnattr_setsigdefault(&attr, &sigdefault);
+  posix_spawnattr_setsigmask(&attr, &sigmask);
+
+  err = posix_spawnp(pid, cmd, &fa, &attr, (char *const *)args, environ);
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&fa);
+  return err;
+#else
+  sigset_t sigmask;
+
+  *pid = fork();
+  if (*pid == -1)
+    return errno;
+  if (*pid == 0) {
+    setpgid(0, 0);
+    if (!workingDirectory.empty() && chdir(workingDirectory.c_str()) != 0)
+      _exit(127);
+    dup2(in, 0);
+    dup2(out, 1);
+    if (withStderr)
+      dup2(out, 2);
+    closefds(3);
+
+    for (auto sig : s_defaultsignals)
+      signal(sig, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    sigemptyset(&sigmask);
+    sigprocmask(SIG_SETMASK, &sigmask, nullptr);
+
+    execvp(cmd, (char *const *)args);
+    _exit(127);
+  }
+  return 0;
+#endif
+}
+
 std::unique_ptr<Process>
 Process::CreateWithPipe(const std::string &program,
                         const std::vector<std::string> &args,
                         const std::string &workingDirectory,
                         std::unique_ptr<IPipe> &outPipe, bool withStderr) {
+  int in[2], out[2], wake[2];
   outPipe = nullptr;
-  return nullptr;
+
+  if (pipe2(in, O_CLOEXEC) != 0) {
+    perror("Process::CreateWithPipe(pipe2)");
+    return nullptr;
+  }
+  AutoHandle childIn(in[0]), parentIn(in[1]);
+  if (pipe2(out, O_CLOEXEC) != 0) {
+    perror("Process::CreateWithPipe(pipe2)");
+    return nullptr;
+  }
+  AutoHandle parentOut(out[0]), childOut(out[1]);
+  if (pipe2(wake, O_CLOEXEC | O_NONBLOCK) != 0) {
+    perror("Process::CreateWithPipe(pipe2)");
+    return nullptr;
+  }
+  AutoHandle wakeRead(wake[0]), wakeWrite(wake[1]);
+
+  /* only our ends, the child gets blocking pipes as usual */
+  if (fcntl((int)parentIn, F_SETFL, O_NONBLOCK) != 0 ||
+      fcntl((int)parentOut, F_SETFL, O_NONBLOCK) != 0) {
+    perror("Process::CreateWithPipe(fcntl)");
+    return nullptr;
+  }
+
+  std::vector<const char *> argsV;
+  argsV.push_back(program.c_str());
+  for (auto &a : args) {
+    argsV.push_back(a.c_str());
+  }
+  argsV.push_back(nullptr);
+
+  pid_t pid;
+  int err = spawnpipe(program.c_str(), argsV.data(), workingDirectory,
+                      (int)childIn, (int)childOut, withStderr, &pid);
+  if (err != 0) {
+    fprintf(stderr, "posix_spawn %s: %s\n", program.c_str(), strerror(err));
+    return nullptr;
+  }
+
+  outPipe = std::unique_ptr<Pipe>(
+      new Pipe(std::move(parentOut), std::move(parentIn), std::move(wakeRead),
+               std::move(wakeWrite)));
+  return std::unique_ptr<Process>(new Process(pid));
 }
 
 std::unique_ptr<Process>
@@ -149,6 +386,30 @@ Process::CreateWithPseudoTerminal(const std::string &program,
                                   const std::vector<std::string> &args,
                                   const std::string &workingDirectory,
                                   Terminal::PseudoTerminal &pseudoTerminal) {
+  ShellVars vars;
+  if (!shellvars(vars))
+    return nullptr;
+
+  std::vector<const char *> argsV;
+  argsV.push_back(program.c_str());
+  for (auto &a : args) {
+    argsV.push_back(a.c_str());
+  }
+  argsV.push_back(nullptr);
+
+#ifdef HEXE_POSIX_SPAWN
+  pid_t spawned;
+  int err = spawnshell(program.c_str(), argsV.data(), vars,
+                       (int)pseudoTerminal.m_slave, &spawned);
+  if (err == 0) {
+    pseudoTerminal.m_slave.Release();
+    return std::unique_ptr<Process>(new Process(spawned));
+  }
+  /* fork() then starts a child that fails the same way, with exit status 1,
+   * which is how a bad program has always been reported */
+  fprintf(stderr, "posix_spawn %s: %s\n", program.c_str(), strerror(err));
+#endif
+
   int pid = fork();
   if (pid == -1) {
     fprintf(stderr, "Failed to fork process\n");
@@ -165,9 +426,7 @@ Process::CreateWithPseudoTerminal(const std::string &program,
     }
 
     // Make sure all non stdio file descriptors are closed before exec
-    int fdlimit = (int)sysconf(_SC_OPEN_MAX);
-    for (int i = 3; i < fdlimit; i++)
-      close(i);
+    closefds(3);
 
 #ifdef __OpenBSD__
     if (pledge("stdio getpw proc exec", NULL) == -1) {
@@ -175,13 +434,7 @@ Process::CreateWithPseudoTerminal(const std::string &program,
       exit(1);
     }
 #endif
-    std::vector<const char *> argsV;
-    argsV.push_back(program.c_str());
-    for (auto &a : args) {
-      argsV.push_back(a.c_str());
-    }
-    argsV.push_back(nullptr);
-    execshell(program.c_str(), argsV.data());
+    execshell(program.c_str(), argsV.data(), vars);
   } else {
     pseudoTerminal.m_slave.Release();
     return std::unique_ptr<Process>(new Process(pid));
@@ -119,6 +119,8 @@ void Process::CheckExitStatus()
 
 bool Process::HasExited() const { return m_status == ProcessStatus::EXITED; }
 
+int Process::GetPollFd() const { return -1; }
+
 int Process::GetExitCode() const
 {
     return m_status == ProcessStatus::EXITED ? m_exitCode : STILL_ACTIVE;
@@ -24,6 +24,8 @@
 // Windows has its own source file
 #include "Hexe/Terminal/PseudoTerminal.h"
 #include <cstdio>
+#include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <pty.h>
 #include <string.h>
@@ -35,9 +37,11 @@ using namespace Hexe::Terminal;
 
 PseudoTerminal::~PseudoTerminal() {}
 PseudoTerminal::PseudoTerminal(int columns, int rows, AutoHandle &&master,
-                               AutoHandle &&slave)
+                               AutoHandle &&slave, AutoHandle &&wakeRead,
+                               AutoHandle &&wakeWrite)
     : m_columns(columns), m_rows(rows), m_master(std::move(master)),
-      m_slave(std::move(slave)) {}
+      m_slave(std::move(slave)), m_wakeRead(std::move(wakeRead)),
+      m_wakeWrite(std::move(wakeWrite)) {}
 
 bool PseudoTerminal::IsTTY() const { return true; }
 
@@ -53,6 +57,8 @@ bool PseudoTerminal::Resize(int columns, int rows) {
     perror("PseudoTerminal::Resize");
     return false;
   }
+  m_columns = columns;
+  m_rows = rows;
 
   return true;
 }
@@ -61,37 +67,78 @@ int PseudoTerminal::GetNumColumns() const { return m_columns; }
 
 int PseudoTerminal::GetNumRows() const { return m_rows; }
 
+/* the master is non-blocking, what the pty can't take now is left to the caller */
 int PseudoTerminal::Write(const char *s, size_t n) {
-  size_t c = n;
-  while (n > 0) {
-    ssize_t r = write((int)m_master, s, n);
+  size_t c = 0;
+  while (c < n) {
+    ssize_t r = write((int)m_master, s + c, n - c);
     if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN)
+        break;
       return -1;
     }
-    n -= r;
-    s += r;
+    c += r;
   }
-  return c;
+  return (int)c;
 }
 
 int PseudoTerminal::Read(char *s, size_t n, bool block) {
-  struct pollfd pfd;
-  pfd.fd = (int)m_master;
-  pfd.events = POLLIN;
-  pfd.revents = 0;
-
-  if (!block) {
-    auto i = poll(&pfd, 1, 0);
-    if (i == 0 || !(pfd.revents & POLLIN)) {
-      return 0;
-    }
+  struct pollfd pfd[2];
+  pfd[0].fd = (int)m_master;
+  pfd[0].events = POLLIN;
+  pfd[0].revents = 0;
+  /* the wake pipe is never drained, so an interrupt sticks */
+  pfd[1].fd = (int)m_wakeRead;
+  pfd[1].events = POLLIN;
+  pfd[1].revents = 0;
+  /* a blocking read has to return on hangup too, or it would never return */
+  short ready = block ? (POLLIN | POLLHUP | POLLERR) : POLLIN;
+
+  for (;;) {
+    auto i = poll(pfd, 2, block ? -1 : 0);
     if (i < 0) {
+      if (errno == EINTR)
+        continue;
       perror("PseudoTerminal::Reader(poll)");
       return -1;
     }
+    if (pfd[1].revents & POLLIN)
+      return 0;
+    if (i == 0 || !(pfd[0].revents & ready)) {
+      if (block)
+        continue;
+      return 0;
+    }
+    ssize_t r = read((int)m_master, s, n);
+    /* another reader may have taken what poll() saw */
+    if (r < 0 && errno == EAGAIN) {
+      if (block)
+        continue;
+      return 0;
+    }
+    return (int)r;
   }
-  ssize_t r = read((int)m_master, s, n);
-  return (int)r;
+}
+
+void PseudoTerminal::Interrupt() {
+  char c = 0;
+  ssize_t r;
+
+  do {
+    r = write((int)m_wakeWrite, &c, 1);
+  } while (r < 0 && errno == EINTR);
+}
+
+int PseudoTerminal::GetPollFd() const { return (int)m_master; }
+
+size_t PseudoTerminal::GetPending() const {
+  int n = 0;
+
+  if (ioctl((int)m_master, FIONREAD, &n) < 0 || n < 0)
+    return 0;
+  return (size_t)n;
 }
 
 std::unique_ptr<PseudoTerminal> PseudoTerminal::Create(int columns, int rows) {
@@ -110,8 +157,25 @@ std::unique_ptr<PseudoTerminal> PseudoTerminal::Create(int columns, int rows) {
     return nullptr;
   }
 
-  return std::unique_ptr<PseudoTerminal>(
-      new PseudoTerminal(columns, rows, std::move(master), std::move(slave)));
+  /* writes must not block while the child doesn't read, or it would stall
+   * the emulator that should read what the child writes */
+  int flags = fcntl((int)master, F_GETFL);
+  if (flags < 0 || fcntl((int)master, F_SETFL, flags | O_NONBLOCK) != 0) {
+    perror("PseudoTerminal::Create(fcntl)");
+    return nullptr;
+  }
+
+  int wake[2];
+  if (pipe2(wake, O_CLOEXEC | O_NONBLOCK) != 0) {
+    perror("PseudoTerminal::Create(pipe2)");
+    return nullptr;
+  }
+  AutoHandle wakeRead(wake[0]);
+  AutoHandle wakeWrite(wake[1]);
+
+  return std::unique_ptr<PseudoTerminal>(new PseudoTerminal(
+      columns, rows, std::move(master), std::move(slave), std::move(wakeRead),
+      std::move(wakeWrite)));
 }
 
 #endif
@@ -33,7 +33,7 @@ PseudoTerminal::~PseudoTerminal()
 }
 
 PseudoTerminal::PseudoTerminal(int columns, int rows, AutoHandle &&hInput, AutoHandle &&hOutput, HPCON hPC)
-    : m_hInput(std::move(hInput)), m_hOutput(std::move(hOutput)), m_phPC(hPC), m_attached(false)
+    : m_hInput(std::move(hInput)), m_hOutput(std::move(hOutput)), m_phPC(hPC), m_attached(false), m_interrupted(false)
 {
     m_size.X = (SHORT)columns;
     m_size.Y = (SHORT)rows;
@@ -82,6 +82,9 @@ int PseudoTerminal::Read(char *buf, size_t n, bool block)
     DWORD available;
     DWORD read;
 
+    if (m_interrupted)
+        return 0;
+
     if (!block)
     {
         if (!PeekNamedPipe((HANDLE)m_hInput, nullptr, 0, nullptr, &available, nullptr))
@@ -95,12 +98,22 @@ int PseudoTerminal::Read(char *buf, size_t n, bool block)
 
     if (!ReadFile((HANDLE)m_hInput, buf, (DWORD)n, &read, nullptr))
     {
+        if (m_interrupted && GetLastError() == ERROR_OPERATION_ABORTED)
+            return 0;
         PrintLastWinApiError();
         return -1;
     }
     return (int)read;
 }
 
+void PseudoTerminal::Interrupt()
+{
+    m_interrupted = true;
+    // Synchronous reads are cancelled from another thread with CancelIoEx, a read that had not
+    // started yet sees the flag instead
+    CancelIoEx((HANDLE)m_hInput, nullptr);
+}
+
 int PseudoTerminal::GetNumColumns() const
 {
     return m_size.X;
@@ -0,0 +1,162 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+#include "Hexe/Terminal/SessionRecorder.h"
+#include "SpscRing.h"
+#include <errno.h>
+#include <string.h>
+
+using namespace Hexe::Terminal;
+
+/* the writer flushes at least this often, however little was recorded */
+static const std::chrono::milliseconds flushinterval(1000);
+
+struct FrameHeader
+{
+    uint64_t time;    /* microseconds since the start of the recording */
+    uint32_t size;    /* nb of bytes of output that follow */
+    uint32_t dropped; /* nb of bytes dropped right before this frame */
+};
+
+SessionRecorder::SessionRecorder(FILE *file, size_t budget)
+    : m_file(file), m_start(std::chrono::steady_clock::now()), m_idle(false), m_stop(false), m_gap(0), m_recorded(0), m_dropped(0), m_droppedFrames(0), m_error(0)
+{
+    size_t size = 4096;
+    while (size * 2 <= budget)
+        size <<= 1;
+
+    m_ring.reset(new SpscRing(size));
+    m_flushsize = size / 4;
+    m_thread = std::thread(&SessionRecorder::writer, this);
+}
+
+SessionRecorder::~SessionRecorder()
+{
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        m_stop = true;
+        m_ready.notify_one();
+    }
+    m_thread.join();
+
+    /* an empty frame tells how much was dropped after the last one */
+    if (m_gap && !m_error)
+    {
+        FrameHeader h;
+        h.time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count();
+        h.size = 0;
+        h.dropped = m_gap < UINT32_MAX ? (uint32_t)m_gap : UINT32_MAX;
+        fwrite(&h, sizeof(h), 1, m_file);
+    }
+    fclose(m_file);
+}
+
+std::unique_ptr<SessionRecorder> SessionRecorder::Create(const std::string &path, size_t budget)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+        return nullptr;
+
+    /* the ring is the buffer, every flush goes to the file as it is */
+    setvbuf(file, nullptr, _IONBF, 0);
+
+    uint64_t start = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    if (fwrite("HEXEREC1", 8, 1, file) != 1 || fwrite(&start, sizeof(start), 1, file) != 1)
+    {
+        fclose(file);
+        return nullptr;
+    }
+
+    return std::unique_ptr<SessionRecorder>(new SessionRecorder(file, budget));
+}
+
+void SessionRecorder::Record(const char *buf, size_t n)
+{
+    FrameHeader h;
+    size_t total = sizeof(h) + n;
+
+    if (n == 0)
+        return;
+
+    if (m_ring->Free() < total)
+    {
+        m_gap += n;
+        m_dropped.store(m_dropped.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        m_droppedFrames.store(m_droppedFrames.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    else
+    {
+        h.time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count();
+        h.size = (uint32_t)n;
+        h.dropped = m_gap < UINT32_MAX ? (uint32_t)m_gap : UINT32_MAX;
+        m_ring->Put(0, &h, sizeof(h));
+        m_ring->Put(sizeof(h), buf, n);
+        m_ring->Commit(total);
+
+        m_gap = 0;
+        m_recorded.store(m_recorded.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    /* only wake the writer for a flush worth a write, or when a frame didn't fit */
+    if (m_ring->Size() >= m_flushsize || m_gap)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_idle)
+        {
+            std::lock_guard<std::mutex> lk(m_lock);
+            m_ready.notify_one();
+        }
+    }
+}
+
+void SessionRecorder::writer()
+{
+    std::unique_lock<std::mutex> lk(m_lock);
+
+    while (!m_stop)
+    {
+        m_idle = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        m_ready.wait_for(lk, flushinterval, [this] { return m_stop || m_ring->Size() >= m_flushsize; });
+        m_idle = false;
+
+        lk.unlock();
+        flush();
+        lk.lock();
+    }
+
+    lk.unlock();
+    flush();
+}
+
+/* writes what the ring holds, in at most two writes as it may wrap around */
+void SessionRecorder::flush()
+{
+    const char *p;
+    size_t n;
+
+    while ((n = m_ring->ReadSpan(&p)) > 0)
+    {
+        if (!m_error && fwrite(p, 1, n, m_file) != n)
+            m_error = errno ? errno : EIO;
+        m_ring->Consume(n);
+    }
+}
@@ -0,0 +1,129 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+#pragma once
+#include <atomic>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace Hexe
+{
+    namespace Terminal
+    {
+        /*
+         * Lock-free byte ring for one producer thread and one consumer thread.
+         * Both sides work on contiguous spans of the ring in place: the
+         * producer fills WriteSpan() and publishes it with Commit(), the
+         * consumer parses ReadSpan() and releases it with Consume(). The two
+         * indices only ever grow and live on their own cache lines.
+         *
+         * The ring never blocks. A side that sleeps while the ring is full or
+         * empty has to publish that it is waiting and then check the ring
+         * again, with a seq_cst fence in between, as does the other side
+         * between moving its index and looking at the flag.
+         */
+        class SpscRing final
+        {
+        private:
+            static constexpr size_t CACHE_LINE = 64;
+
+            char *m_buf;
+            size_t m_mask;
+
+            alignas(CACHE_LINE) std::atomic<size_t> m_head; /* bytes committed, written by the producer */
+            alignas(CACHE_LINE) std::atomic<size_t> m_tail; /* bytes consumed, written by the consumer */
+
+        public:
+            // The capacity is rounded up to a power of two
+            explicit SpscRing(size_t capacity)
+                : m_head(0), m_tail(0)
+            {
+                size_t size = 1;
+                while (size < capacity)
+                    size <<= 1;
+                m_buf = (char *)malloc(size);
+                m_mask = size - 1;
+            }
+            ~SpscRing() { free(m_buf); }
+
+            SpscRing(const SpscRing &) = delete;
+            SpscRing &operator=(const SpscRing &) = delete;
+
+            inline size_t Capacity() const { return m_mask + 1; }
+
+            // Producer: the contiguous free space at the write position, 0 when the ring is full
+            inline size_t WriteSpan(char **p) const
+            {
+                size_t head = m_head.load(std::memory_order_relaxed);
+                size_t free = Capacity() - (head - m_tail.load(std::memory_order_acquire));
+
+                *p = m_buf + (head & m_mask);
+                return MinSize(free, Capacity() - (head & m_mask));
+            }
+            inline void Commit(size_t n) { m_head.store(m_head.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+
+            // Producer: nb of bytes that can be committed right now, wrapped or not
+            inline size_t Free() const
+            {
+                return Capacity() - (m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire));
+            }
+
+            // Producer: copies n bytes to offset bytes past the write position, across the end of the ring if
+            // needed, without committing them. The caller checks Free() first, so a record made of several
+            // parts is committed at once.
+            inline void Put(size_t offset, const void *src, size_t n)
+            {
+                size_t pos = (m_head.load(std::memory_order_relaxed) + offset) & m_mask;
+                size_t first = MinSize(n, Capacity() - pos);
+
+                memcpy(m_buf + pos, src, first);
+                memcpy(m_buf, (const char *)src + first, n - first);
+            }
+
+            // Consumer: the contiguous committed bytes at the read position, 0 when the ring is empty
+            inline size_t ReadSpan(const char **p) const
+            {
+                size_t tail = m_tail.load(std::memory_order_relaxed);
+                size_t avail = m_head.load(std::memory_order_acquire) - tail;
+
+                *p = m_buf + (tail & m_mask);
+                return MinSize(avail, Capacity() - (tail & m_mask));
+            }
+            inline void Consume(size_t n) { m_tail.store(m_tail.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+
+            // Either side: nb of committed bytes not consumed yet
+            inline size_t Size() const
+            {
+                return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+            }
+
+            // Either side: whether the ring holds no committed bytes right now
+            inline bool Empty() const
+            {
+                return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+            }
+
+        private:
+            static inline size_t MinSize(size_t a, size_t b) { return a < b ? a : b; }
+        };
+    } // namespace Terminal
+} // namespace Hexe
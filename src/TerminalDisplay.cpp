@@ -68,3 +68,14 @@ void TerminalDisplay::SetTitle(const char *title) {}
 void TerminalDisplay::SetIconTitle(const char *title) {}
 void TerminalDisplay::SetClipboard(const char *text) {}
 const char *TerminalDisplay::GetClipboard() const { return ""; }
+
+void TerminalDisplay::SetViewOffset(int offset)
+{
+    if (m_emulator)
+        m_emulator->SetViewOffset(offset);
+}
+
+int TerminalDisplay::GetViewOffset() const
+{
+    return m_emulator ? m_emulator->GetViewOffset() : 0;
+}
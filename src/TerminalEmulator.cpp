@@ -34,8 +34,12 @@
 //  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
 //  DEALINGS IN THE SOFTWARE.
 #include "Hexe/Terminal/TerminalEmulator.h"
+#include "Hexe/Terminal/ParserPool.h"
+#include "Hexe/Terminal/SessionRecorder.h"
+#include "Hexe/Terminal/TerminalReactor.h"
 #include "boxdraw_data.h"
-#include "emoji_blocks.h"
+#include "runeprops.h"
+#include "SpscRing.h"
 
 #include <assert.h>
 #include <ctype.h>
@@ -43,6 +47,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -50,12 +55,33 @@
 #include <sys/types.h>
 #include "config.def.h"
 #include <cmath>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define HEXE_AVX2 1
+#define HEXE_SSE2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HEXE_SSE2 1
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) < (b) ? (b) : (a))
 #define LEN(a) (sizeof(a) / sizeof(a)[0])
 #define BETWEEN(x, a, b) ((a) <= (x) && (x) <= (b))
 #define DIVCEIL(n, d) (((n) + ((d)-1)) / (d))
+#ifdef HEXE_PACKED_CELLS
+#define CELLEQ(a, b) ((a).u == (b).u && (a).mode == (b).mode && (a).style == (b).style)
+#else
+#define CELLEQ(a, b) ((a).u == (b).u && (a).mode == (b).mode && (a).fg == (b).fg && (a).bg == (b).bg)
+#endif
 #define DEFAULT(a, b) (a) = (a) ? (a) : (b)
 #define LIMIT(x, a, b) (x) = (x) < (a) ? (a) : (x) > (b) ? (b) : (x)
 #define ATTRCMP(a, b) ((a).mode != (b).mode || (a).fg != (b).fg || \
@@ -76,56 +102,14 @@
 #define ISCONTROLC0(c) (BETWEEN(c, 0, 0x1f) || (c) == 0x7f)
 #define ISCONTROLC1(c) (BETWEEN(c, 0x80, 0x9f))
 #define ISCONTROL(c) (ISCONTROLC0(c) || ISCONTROLC1(c))
-#define ISDELIM(u) (u && Hexe_wcschr(worddelimiters, u))
+#define ISDELIM(u) isdelim(u)
+/* row y of the screen, negative rows are history lines of the main screen */
+#define TLINE(y) ((y) < 0 ? term.ring[term.head + term.ringcap + (y)] : term.line[(y)])
+/* columns a..b-1 of line y are damaged already, comparing them is pointless */
+#define ISDIRTY(y, a, b) (term.dirty[(y)].x1 <= (a) && (b) <= term.dirty[(y)].x2)
 
 using namespace Hexe::Terminal;
 
-static inline bool is_emoji_presentation(int32_t code)
-{
-    const emoji_range_t **curr = emoji_ranges;
-    while (*curr != 0)
-    {
-        if (code >= (*curr)->min_code && code <= (*curr)->max_code)
-        {
-            int ofs = code - (*curr)->min_code;
-
-            int byteOffset = ofs / 8;
-            int bit = 1 << (ofs % 8);
-            auto byte = (*curr)->bitmap[byteOffset];
-
-            return ((*curr)->bitmap[byteOffset] & bit) == bit;
-        }
-        ++curr;
-    }
-    return false;
-}
-
-static inline bool
-is_emoji(int32_t code)
-{
-    if (is_emoji_presentation(code))
-        return true;
-    return false;
-}
-
-static size_t Hexe_wcslen(const Rune *s)
-{
-    const Rune *a;
-    for (a = s; *s; s++)
-        ;
-    return s - a;
-}
-
-static Rune *
-Hexe_wcschr(const Rune *s, Rune c)
-{
-    if (!c)
-        return (Rune *)s + Hexe_wcslen(s);
-    for (; *s && *s != c; s++)
-        ;
-    return *s ? (Rune *)s : 0;
-}
-
 static const uchar utfbyte[UTF_SIZ + 1] = {0x80, 0, 0xC0, 0xE0, 0xF0};
 static const uchar utfmask[UTF_SIZ + 1] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
 static const Rune utfmin[UTF_SIZ + 1] = {0, 0, 0x80, 0x800, 0x10000};
@@ -133,9 +117,19 @@ static const Rune utfmax[UTF_SIZ + 1] = {0x10FFFF, 0x7F, 0x7FF, 0xFFFF, 0x10FFFF
 
 int Hexe::Terminal::isboxdraw(Rune u)
 {
-    Rune block = u & ~0xff;
-    return (block == 0x2500 && boxdata[u & 0xFF]) ||
-           (block == 0x2800);
+    return (runeprops(u) & RUNE_BOXDRAW) != 0;
+}
+
+/* worddelimiters is a setting, so it is searched instead of baked into runeprops */
+static int
+isdelim(Rune u)
+{
+    for (const unsigned int *d = worddelimiters; u && *d; d++)
+    {
+        if (*d == u)
+            return 1;
+    }
+    return 0;
 }
 
 /* the "index" is actually the entire shape data encoded as ushort */
@@ -181,11 +175,16 @@ xstrdup(char *s)
     return s;
 }
 
+static size_t asciispan(const Rune *, size_t);
+static size_t narrowspan(const Rune *, size_t);
+static int cellspan(const Cell *, int, const Cell *);
 static size_t utf8decode(const char *, Rune *, size_t);
+static size_t utf8decodebulk(UTF8Decoder *, const char *, size_t, Rune *, size_t, size_t *);
 static Rune utf8decodebyte(char, size_t *);
 static char utf8encodebyte(Rune, size_t);
 static size_t utf8validate(Rune *, size_t);
 static size_t utf8encode(Rune, char *);
+static size_t runeencode(Rune, char *, int);
 
 static char *base64dec(const char *);
 static char base64dec_getc(const char **);
@@ -227,6 +226,18 @@ Rune utf8decodebyte(char c, size_t *i)
     return 0;
 }
 
+/* bytes of u as they appear in the input stream */
+size_t
+runeencode(Rune u, char *c, int utf8)
+{
+    if (u < 127 || !utf8)
+    {
+        c[0] = u;
+        return 1;
+    }
+    return utf8encode(u, c);
+}
+
 size_t
 utf8encode(Rune u, char *c)
 {
@@ -262,6 +273,207 @@ utf8validate(Rune *u, size_t i)
     return i;
 }
 
+static inline int
+ctz32(uint32_t x)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (int)i;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+/* length of the leading run of printable ASCII (0x20 - 0x7e) in u */
+size_t
+asciispan(const Rune *u, size_t n)
+{
+    size_t i = 0;
+
+    /* runes never exceed 0x10ffff, so signed compares are fine */
+#ifdef HEXE_AVX2
+    const __m256i lo8 = _mm256_set1_epi32(0x1f);
+    const __m256i hi8 = _mm256_set1_epi32(0x7f);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(u + i));
+        __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi32(v, lo8), _mm256_cmpgt_epi32(hi8, v));
+        uint32_t bad = ~(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(ok)) & 0xff;
+        if (bad)
+            return i + ctz32(bad);
+    }
+#endif
+#ifdef HEXE_SSE2
+    const __m128i lo4 = _mm_set1_epi32(0x1f);
+    const __m128i hi4 = _mm_set1_epi32(0x7f);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(u + i));
+        __m128i ok = _mm_and_si128(_mm_cmpgt_epi32(v, lo4), _mm_cmpgt_epi32(hi4, v));
+        uint32_t bad = ~(uint32_t)_mm_movemask_ps(_mm_castsi128_ps(ok)) & 0xf;
+        if (bad)
+            return i + ctz32(bad);
+    }
+#endif
+    for (; i < n && BETWEEN(u[i], 0x20, 0x7e); i++)
+        ;
+
+    return i;
+}
+
+/* length of the leading run of printable runes that take one column each */
+size_t
+narrowspan(const Rune *u, size_t n)
+{
+    size_t i = 0, start;
+
+    do
+    {
+        start = i;
+        i += asciispan(u + i, n - i);
+        while (i < n && u[i] >= 0x80 && (runeprops(u[i]) & (RUNE_WIDTH | RUNE_CONTROL)) == 1)
+            i++;
+    } while (i < n && i != start);
+
+    return i;
+}
+
+/* the cell for the narrow rune u, with the attributes of c */
+static inline Cell
+runecell(Cell c, Rune u)
+{
+    c.u = u;
+    if (u >= 0x2500 && runeprops(u) & RUNE_BOXDRAW)
+        c.mode |= ATTR_BOXDRAW;
+    return c;
+}
+
+/* length of the leading run of cells in cp equal to c */
+int
+cellspan(const Cell *cp, int n, const Cell *c)
+{
+    int i = 0;
+
+#ifdef HEXE_SSE2
+#ifdef HEXE_PACKED_CELLS
+    static_assert(sizeof(Cell) == 8, "two cells per compare");
+    uint64_t c64;
+    memcpy(&c64, c, sizeof(c64));
+    const __m128i want2 = _mm_set1_epi64x((long long)c64);
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(cp + i));
+        uint32_t diff = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, want2)) & 0xffff;
+        if (diff)
+            return i + ctz32(diff) / 8;
+    }
+#else
+    static_assert(sizeof(Cell) == 16 && offsetof(Glyph, fg) == 8, "one cell per compare");
+    /* bytes 6 and 7 are padding that holds garbage */
+    const uint32_t pad = 0xc0;
+    const __m128i want1 = _mm_set_epi32((int)c->bg, (int)c->fg, c->mode, (int)c->u);
+    for (; i < n; i++)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(cp + i));
+        uint32_t diff = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, want1)) & 0xffff & ~pad;
+        if (diff)
+            return i;
+    }
+#endif
+#endif
+    for (; i < n && CELLEQ(cp[i], *c); i++)
+        ;
+
+    return i;
+}
+
+/*
+ * Decode up to outlen runes from s into out, with the same results as
+ * utf8decode() applied byte by byte. Decoding stops after an ESC, because
+ * the sequence it starts may switch MODE_UTF8 off. An incomplete sequence
+ * at the end of s is kept in dec for the next call. Returns the number of
+ * runes decoded and sets *used to the number of bytes consumed.
+ */
+size_t
+utf8decodebulk(UTF8Decoder *dec, const char *s, size_t n, Rune *out, size_t outlen, size_t *used)
+{
+    const uchar *p = (const uchar *)s;
+    const uchar *end = p + n;
+    size_t o = 0;
+    uchar c;
+
+    while (p < end && o < outlen)
+    {
+        if (dec->need == 0)
+        {
+#ifdef HEXE_SSE2
+            /* widen ASCII 16 bytes at a time, up to the first ESC or multibyte byte */
+            const __m128i esc = _mm_set1_epi8(0x1b);
+            const __m128i zero = _mm_setzero_si128();
+            while (end - p >= 16 && outlen - o >= 16)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i *)p);
+                uint32_t stop = _mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, esc)));
+                __m128i lo = _mm_unpacklo_epi8(v, zero);
+                __m128i hi = _mm_unpackhi_epi8(v, zero);
+                _mm_storeu_si128((__m128i *)(out + o), _mm_unpacklo_epi16(lo, zero));
+                _mm_storeu_si128((__m128i *)(out + o + 4), _mm_unpackhi_epi16(lo, zero));
+                _mm_storeu_si128((__m128i *)(out + o + 8), _mm_unpacklo_epi16(hi, zero));
+                _mm_storeu_si128((__m128i *)(out + o + 12), _mm_unpackhi_epi16(hi, zero));
+                if (stop)
+                {
+                    p += ctz32(stop);
+                    o += ctz32(stop);
+                    break;
+                }
+                p += 16;
+                o += 16;
+            }
+            if (p == end || o == outlen)
+                break;
+#endif
+            c = *p++;
+            if (c < 0x80)
+            {
+                out[o++] = c;
+                if (c == 0x1b)
+                    break;
+                continue;
+            }
+            if (c < 0xc0 || c >= 0xf8)
+            {
+                /* stray continuation byte or invalid lead byte */
+                out[o++] = UTF_INVALID;
+                continue;
+            }
+            dec->len = (c < 0xe0) ? 2 : (c < 0xf0) ? 3 : 4;
+            dec->need = dec->len - 1;
+            dec->cp = c & ~utfmask[dec->len];
+        }
+
+        while (dec->need > 0 && p < end && (*p & 0xc0) == 0x80)
+        {
+            dec->cp = (dec->cp << 6) | (*p++ & 0x3f);
+            dec->need--;
+        }
+        if (dec->need == 0)
+        {
+            out[o] = dec->cp;
+            utf8validate(&out[o++], dec->len);
+        }
+        else if (p < end)
+        {
+            /* sequence cut short, the offending byte starts a new one */
+            out[o++] = UTF_INVALID;
+            dec->need = 0;
+        }
+    }
+
+    *used = p - (const uchar *)s;
+    return o;
+}
+
 static const char base64_digits[] = {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 62, 0, 0, 0,
@@ -325,11 +537,12 @@ void TerminalEmulator::selinit(void)
 int TerminalEmulator::tlinelen(int y)
 {
     int i = term.col;
+    Line line = TLINE(y);
 
-    if (term.line[y][i - 1].mode & ATTR_WRAP)
+    if (line[i - 1].mode & ATTR_WRAP)
         return i;
 
-    while (i > 0 && term.line[y][i - 1].u == ' ')
+    while (i > 0 && line[i - 1].u == ' ')
         --i;
 
     return i;
@@ -410,6 +623,15 @@ void TerminalEmulator::selnormalize(void)
         sel.ne.x = term.col - 1;
 }
 
+bool TerminalEmulator::IsLineSelected(int row)
+{
+    if (sel.mode == SEL_EMPTY || sel.ob.x == -1 ||
+        sel.alt != IS_SET(MODE_ALTSCREEN))
+        return false;
+
+    return BETWEEN(row - term.scr, sel.nb.y, sel.ne.y);
+}
+
 int TerminalEmulator::selected(int x, int y)
 {
     if (sel.mode == SEL_EMPTY || sel.ob.x == -1 ||
@@ -426,7 +648,8 @@ void TerminalEmulator::selsnap(int *x, int *y, int direction)
 {
     int newx, newy, xt, yt;
     int delim, prevdelim;
-    Glyph *gp, *prevgp;
+    int top = IS_SET(MODE_ALTSCREEN) ? 0 : -term.histlen;
+    Cell *gp, *prevgp;
 
     switch (sel.snap)
     {
@@ -435,7 +658,7 @@ void TerminalEmulator::selsnap(int *x, int *y, int direction)
 		 * Snap around if the word wraps around at the end or
 		 * beginning of a line.
 		 */
-        prevgp = &term.line[*y][*x];
+        prevgp = &TLINE(*y)[*x];
         prevdelim = ISDELIM(prevgp->u);
         for (;;)
         {
@@ -445,21 +668,21 @@ void TerminalEmulator::selsnap(int *x, int *y, int direction)
             {
                 newy += direction;
                 newx = (newx + term.col) % term.col;
-                if (!BETWEEN(newy, 0, term.row - 1))
+                if (!BETWEEN(newy, top, term.row - 1))
                     break;
 
                 if (direction > 0)
                     yt = *y, xt = *x;
                 else
                     yt = newy, xt = newx;
-                if (!(term.line[yt][xt].mode & ATTR_WRAP))
+                if (!(TLINE(yt)[xt].mode & ATTR_WRAP))
                     break;
             }
 
             if (newx >= tlinelen(newy))
                 break;
 
-            gp = &term.line[newy][newx];
+            gp = &TLINE(newy)[newx];
             delim = ISDELIM(gp->u);
             if (!(gp->mode & ATTR_WDUMMY) && (delim != prevdelim || (delim && gp->u != prevgp->u)))
                 break;
@@ -479,9 +702,9 @@ void TerminalEmulator::selsnap(int *x, int *y, int direction)
         *x = (direction < 0) ? 0 : term.col - 1;
         if (direction < 0)
         {
-            for (; *y > 0; *y += direction)
+            for (; *y > top; *y += direction)
             {
-                if (!(term.line[*y - 1][term.col - 1].mode & ATTR_WRAP))
+                if (!(TLINE(*y - 1)[term.col - 1].mode & ATTR_WRAP))
                 {
                     break;
                 }
@@ -491,7 +714,7 @@ void TerminalEmulator::selsnap(int *x, int *y, int direction)
         {
             for (; *y < term.row - 1; *y += direction)
             {
-                if (!(term.line[*y][term.col - 1].mode & ATTR_WRAP))
+                if (!(TLINE(*y)[term.col - 1].mode & ATTR_WRAP))
                 {
                     break;
                 }
@@ -506,7 +729,7 @@ TerminalEmulator::getsel(void)
 {
     char *str, *ptr;
     int y, bufsize, lastx, linelen;
-    Glyph *gp, *last;
+    Cell *gp, *last;
 
     if (sel.ob.x == -1)
         return NULL;
@@ -525,15 +748,15 @@ TerminalEmulator::getsel(void)
 
         if (sel.type == SEL_RECTANGULAR)
         {
-            gp = &term.line[y][sel.nb.x];
+            gp = &TLINE(y)[sel.nb.x];
             lastx = sel.ne.x;
         }
         else
         {
-            gp = &term.line[y][sel.nb.y == y ? sel.nb.x : 0];
+            gp = &TLINE(y)[sel.nb.y == y ? sel.nb.x : 0];
             lastx = (sel.ne.y == y) ? sel.ne.x : term.col - 1;
         }
-        last = &term.line[y][MIN(lastx, linelen - 1)];
+        last = &TLINE(y)[MIN(lastx, linelen - 1)];
         while (last >= gp && last->u == ' ')
             --last;
 
@@ -587,10 +810,20 @@ void TerminalEmulator::_die(const char *errstr, ...)
 size_t
 TerminalEmulator::ttyread(void)
 {
-    int ret, written;
+    size_t n;
+    int ret;
+
+    n = MIN(MAX(m_readsize, m_pty->GetPending()), readsizemax);
+    if (m_buf.size() < n)
+        m_buf.resize(n);
+
+    ret = m_pty->Read(m_buf.data(), n);
 
-    /* append read bytes to unprocessed bytes */
-    ret = m_pty->Read(m_buf + m_buflen, LEN(m_buf) - m_buflen);
+    /* double the reads while they fill up, and halve them once they come back mostly empty */
+    if (ret == (int)n)
+        m_readsize = MIN(n * 2, readsizemax);
+    else if (ret >= 0 && (size_t)ret < m_readsize / 4)
+        m_readsize = MAX(m_readsize / 2, readsizemin);
 
     switch (ret)
     {
@@ -600,24 +833,270 @@ TerminalEmulator::ttyread(void)
         _die("couldn't read from shell: %s\n", strerror(errno));
         return 0;
     default:
-        m_buflen += ret;
-        written = twrite(m_buf, m_buflen, 0);
-        m_buflen -= written;
-        /* keep any incomplete UTF-8 byte sequence for the next call */
-        if (m_buflen > 0)
-            memmove(m_buf, m_buf + written, m_buflen);
+        if (m_recorder)
+            m_recorder->Record(m_buf.data(), ret);
+        /* an incomplete UTF-8 sequence at the end is kept in m_utf8 */
+        twrite(m_buf.data(), ret, 0, &m_utf8);
+        m_jumpBytes += ret;
         return ret;
     }
 
     return 0;
 }
 
+/* reads until the pty has nothing more, but at most a batch, so a flood can't hold up drawing */
+size_t
+TerminalEmulator::ttyreadn(void)
+{
+    size_t total = 0;
+    size_t ret;
+
+    while (total < m_readbatch && m_status != TERMINATED && (ret = ttyread()) > 0)
+        total += ret;
+
+    if (total >= m_readbatch)
+        m_readbatch = MIN(m_readbatch * 2, readbatchmax);
+    else
+        m_readbatch = readbatchmin;
+    return total;
+}
+
+/*
+ * The reader thread blocks in the pty and queues what it reads. The parser
+ * takes it from the ring in Update(), or on a thread of its own, and wakes
+ * the reader when the ring had filled up. The reader in turn wakes a parser
+ * thread that found the ring empty.
+ */
+struct TerminalEmulator::Reader
+{
+    SpscRing ring;
+    std::thread thread;
+    std::thread parser;
+    std::mutex lock;
+    std::condition_variable space;  /* ring space was freed, or stop was set */
+    std::condition_variable ready;  /* bytes were committed, or stop was set */
+    std::condition_variable exited; /* done was set */
+    std::atomic<bool> waiting;      /* the reader sleeps on a full ring */
+    std::atomic<bool> idle;         /* the parser thread sleeps on an empty ring */
+    std::atomic<bool> stop;
+    std::atomic<bool> done;
+    int error; /* errno of the read that ended the reader, 0 on end of file */
+
+    explicit Reader(size_t size)
+        : ring(size), waiting(false), idle(false), stop(false), done(false), error(0)
+    {
+    }
+};
+
+void TerminalEmulator::ttyreader()
+{
+    Reader *r = m_reader.get();
+    char *p;
+    size_t n;
+    int ret;
+
+    for (;;)
+    {
+        n = r->ring.WriteSpan(&p);
+        if (n == 0)
+        {
+            std::unique_lock<std::mutex> lk(r->lock);
+            r->waiting = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (!r->stop && (n = r->ring.WriteSpan(&p)) == 0)
+                r->space.wait(lk);
+            r->waiting = false;
+            if (r->stop)
+                break;
+        }
+
+        ret = m_pty->Read(p, n, true);
+        if (ret > 0)
+        {
+            if (m_recorder)
+                m_recorder->Record(p, ret);
+            r->ring.Commit(ret);
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (r->idle)
+            {
+                std::lock_guard<std::mutex> lk(r->lock);
+                r->ready.notify_one();
+            }
+            continue;
+        }
+        /* 0 is end of file, or Interrupt() */
+        if (ret < 0 && !r->stop)
+            r->error = errno;
+        break;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(r->lock);
+        r->done = true;
+    }
+    r->exited.notify_all();
+}
+
+size_t TerminalEmulator::ttydrain(size_t budget)
+{
+    Reader *r = m_reader.get();
+    size_t total = 0;
+    const char *p;
+    size_t n;
+
+    while (budget > 0 && (n = r->ring.ReadSpan(&p)) > 0)
+    {
+        n = MIN(n, budget);
+        /* an incomplete UTF-8 sequence at the end is kept in m_utf8 */
+        twrite(p, n, 0, &m_utf8);
+        r->ring.Consume(n);
+        budget -= n;
+        total += n;
+        m_jumpBytes += n;
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (r->waiting)
+        {
+            std::lock_guard<std::mutex> lk(r->lock);
+            r->space.notify_one();
+        }
+    }
+    return total;
+}
+
+/* nb of bytes the pty or the reader ring holds that weren't parsed yet */
+size_t TerminalEmulator::ttypending()
+{
+    if (m_reader)
+        return m_reader->ring.Size();
+    return m_pty ? m_pty->GetPending() : 0;
+}
+
+/*
+ * Jump scroll: whether to leave out this frame, because the output goes on
+ * for more screens than are worth showing one by one. The screen the output
+ * ends on is always drawn, as nothing is pending then.
+ */
+bool TerminalEmulator::ttyjump()
+{
+    size_t screen = (size_t)term.row * term.col;
+
+    if (m_jumpScroll <= 0 || m_jumpBytes == 0)
+        return false;
+    if (ttypending() == 0 || m_jumpBytes + ttypending() <= m_jumpScroll * screen)
+        return false;
+    if (std::chrono::steady_clock::now() - m_lastDraw >= std::chrono::milliseconds(m_jumpDeadline))
+        return false;
+
+    m_skippedFrames++;
+    return true;
+}
+
+void TerminalEmulator::ttyparser()
+{
+    Reader *r = m_reader.get();
+
+    while (!r->stop)
+    {
+        if (r->ring.Empty())
+        {
+            std::unique_lock<std::mutex> lk(r->lock);
+            r->idle = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (!r->stop && r->ring.Empty())
+                r->ready.wait(lk);
+            r->idle = false;
+            if (r->stop)
+                break;
+        }
+
+        /* the lock is dropped between batches, so input and Update() get their turn during a flood */
+        std::lock_guard<std::mutex> lk(m_lock);
+        if (m_status == TERMINATED)
+            break;
+        ttyflush();
+        ttydrain(parserbatch);
+        if (!ttyjump())
+            draw(true);
+    }
+}
+
+/*
+ * One batch of a ParserPool worker: reads up to parserbatch bytes and draws.
+ * Returns 1 when the pty may hold more, 0 when it ran dry, and -1 once it
+ * hung up or the terminal ended, so it doesn't have to be polled again.
+ */
+int TerminalEmulator::ttybatch(bool readable)
+{
+    std::lock_guard<std::mutex> lk(m_lock);
+    size_t total = 0;
+    size_t ret;
+
+    ttyflush();
+    while (readable && total < parserbatch && m_status != TERMINATED && (ret = ttyread()) > 0)
+        total += ret;
+    if (!ttyjump())
+        draw(true);
+
+    if (!readable || m_status == TERMINATED)
+    {
+        m_hungup = true;
+        return -1;
+    }
+    return total >= parserbatch;
+}
+
+bool TerminalEmulator::StartReader(size_t ringsize)
+{
+    if (!m_pty || m_reader || m_reactor || m_pool)
+        return false;
+
+    m_reader.reset(new Reader(ringsize ? ringsize : readerbuffer));
+    m_reader->thread = std::thread(&TerminalEmulator::ttyreader, this);
+    return true;
+}
+
+bool TerminalEmulator::IsParserThread() const
+{
+    if (m_pool)
+        return ParserPool::GetCurrent() == this;
+    return m_reader && m_reader->parser.get_id() == std::this_thread::get_id();
+}
+
+bool TerminalEmulator::StartParser(size_t ringsize)
+{
+    if (!m_pty || m_reactor || m_pool || (m_reader && m_reader->parser.joinable()))
+        return false;
+    if (!m_reader)
+        StartReader(ringsize);
+
+    m_reader->parser = std::thread(&TerminalEmulator::ttyparser, this);
+    return true;
+}
+
+bool TerminalEmulator::SetRecorder(const std::shared_ptr<SessionRecorder> &recorder)
+{
+    if (m_reader || m_reactor || m_pool)
+        return false;
+
+    m_recorder = recorder;
+    return true;
+}
+
+void TerminalEmulator::Feed(const char *buf, size_t buflen)
+{
+    twrite(buf, buflen, 0, &m_utf8);
+}
+
 void TerminalEmulator::ttywrite(const char *s, size_t n, int may_echo)
 {
     const char *next;
+    UTF8Decoder echo = {};
 
+    /* echoed input is decoded on its own, so it can't disturb the pty stream */
     if (may_echo && IS_SET(MODE_ECHO))
-        twrite(s, (int)n, 1);
+        twrite(s, n, 1, &echo);
 
     if (!IS_SET(MODE_CRLF))
     {
@@ -646,10 +1125,64 @@ void TerminalEmulator::ttywrite(const char *s, size_t n, int may_echo)
 
 void TerminalEmulator::ttywriteraw(const char *s, size_t n)
 {
-    if (m_pty->Write(s, n) < n)
+    int ret = 0;
+
+    /* headless emulators have nobody to answer to */
+    if (!m_pty)
+        return;
+
+    /* what is queued goes first */
+    ttyflush();
+    if (ttyqueued() == 0)
+    {
+        ret = m_pty->Write(s, n);
+        if (ret < 0)
+        {
+            /* EIO is the hangup of an exiting shell, nobody reads the input anymore */
+            if (errno != EIO)
+                _die("Failed to write to TTY");
+            return;
+        }
+        if ((size_t)ret == n)
+            return;
+    }
+
+    /* the pty is full, the child isn't reading */
+    if (m_wqueuepos > m_wqueue.size() / 2)
+    {
+        m_wqueue.erase(m_wqueue.begin(), m_wqueue.begin() + m_wqueuepos);
+        m_wqueuepos = 0;
+    }
+    m_wqueue.insert(m_wqueue.end(), s + ret, s + n);
+    if (m_reactor)
+        m_reactor->WatchWrite(*this, true);
+}
+
+/* writes queued input as far as the pty takes it, and returns how much */
+size_t TerminalEmulator::ttyflush()
+{
+    int ret;
+
+    if (ttyqueued() == 0)
+        return 0;
+
+    ret = m_pty->Write(m_wqueue.data() + m_wqueuepos, ttyqueued());
+    if (ret < 0)
+    {
+        if (errno != EIO)
+            _die("Failed to write to TTY");
+        ret = (int)ttyqueued();
+    }
+
+    m_wqueuepos += ret;
+    if (ttyqueued() == 0)
     {
-        _die("Failed to write to TTY");
+        m_wqueue.clear();
+        m_wqueuepos = 0;
+        if (m_reactor)
+            m_reactor->WatchWrite(*this, false);
     }
+    return ret;
 }
 
 void TerminalEmulator::ttyhangup()
@@ -682,7 +1215,19 @@ void TerminalEmulator::tsetdirt(int top, int bot)
     LIMIT(bot, 0, term.row - 1);
 
     for (i = top; i <= bot; i++)
-        term.dirty[i] = 1;
+    {
+        term.dirty[i].x1 = 0;
+        term.dirty[i].x2 = term.col;
+    }
+}
+
+/* marks columns x1..x2-1 of line y as changed */
+void TerminalEmulator::tsetdirtcols(int y, int x1, int x2)
+{
+    Damage *d = &term.dirty[y];
+
+    d->x1 = MIN(d->x1, MAX(x1, 0));
+    d->x2 = MAX(d->x2, MIN(x2, term.col));
 }
 
 void TerminalEmulator::tsetdirtattr(int attr)
@@ -695,7 +1240,7 @@ void TerminalEmulator::tsetdirtattr(int attr)
         {
             if (term.line[i][j].mode & attr)
             {
-                tsetdirt(i, i);
+                tsetdirtcols(i, j, j + 1);
                 break;
             }
         }
@@ -709,17 +1254,16 @@ void TerminalEmulator::tfulldirt(void)
 
 void TerminalEmulator::tcursor(int mode)
 {
-    static TCursor c[2];
     int alt = IS_SET(MODE_ALTSCREEN);
 
     if (mode == CURSOR_SAVE)
     {
-        c[alt] = term.c;
+        term.sc[alt] = term.c;
     }
     else if (mode == CURSOR_LOAD)
     {
-        term.c = c[alt];
-        tmoveto(c[alt].x, c[alt].y);
+        term.c = term.sc[alt];
+        tmoveto(term.sc[alt].x, term.sc[alt].y);
     }
 }
 
@@ -741,6 +1285,9 @@ void TerminalEmulator::treset(void)
         term.tabs[i] = 1;
     term.top = 0;
     term.bot = term.row - 1;
+    /* the history ring must end up as the main screen */
+    if (IS_SET(MODE_ALTSCREEN))
+        tswapscreen();
     term.mode = MODE_WRAP | MODE_UTF8;
     memset(term.trantbl, CS_USA, sizeof(term.trantbl));
     term.charset = 0;
@@ -773,9 +1320,26 @@ void TerminalEmulator::tswapscreen(void)
     term.line = term.alt;
     term.alt = tmp;
     term.mode ^= MODE_ALTSCREEN;
+    term.scr = 0;
     tfulldirt();
 }
 
+/* copies screen rows y1..y2 to the other half of the ring */
+void TerminalEmulator::tmirror(int y1, int y2)
+{
+    int alt = IS_SET(MODE_ALTSCREEN);
+    Line *ring = alt ? term.altring : term.ring;
+    int cap = alt ? term.row : term.ringcap;
+    int head = alt ? term.althead : term.head;
+    int y, i;
+
+    for (y = y1; y <= y2; y++)
+    {
+        i = head + y;
+        ring[i < cap ? i + cap : i - cap] = ring[i];
+    }
+}
+
 void TerminalEmulator::tscrolldown(int orig, int n)
 {
     int i;
@@ -783,7 +1347,7 @@ void TerminalEmulator::tscrolldown(int orig, int n)
 
     LIMIT(n, 0, term.bot - orig + 1);
 
-    tsetdirt(orig, term.bot - n);
+    tsetdirt(orig, term.bot);
     tclearregion(0, term.bot - n + 1, term.col - 1, term.bot);
 
     for (i = term.bot; i >= orig + n; i--)
@@ -792,6 +1356,7 @@ void TerminalEmulator::tscrolldown(int orig, int n)
         term.line[i] = term.line[i - n];
         term.line[i - n] = temp;
     }
+    tmirror(orig, term.bot);
 
     selscroll(orig, n);
 }
@@ -803,8 +1368,14 @@ void TerminalEmulator::tscrollup(int orig, int n)
 
     LIMIT(n, 0, term.bot - orig + 1);
 
+    if (orig == 0 && term.bot == term.row - 1)
+    {
+        tscrollring(n);
+        return;
+    }
+
+    tsetdirt(orig, term.bot);
     tclearregion(0, orig, term.col - 1, orig + n - 1);
-    tsetdirt(orig + n, term.bot);
 
     for (i = orig; i <= term.bot - n; i++)
     {
@@ -812,10 +1383,253 @@ void TerminalEmulator::tscrollup(int orig, int n)
         term.line[i] = term.line[i + n];
         term.line[i + n] = temp;
     }
+    tmirror(orig, term.bot);
 
     selscroll(orig, -n);
 }
 
+/*
+ * All screen and history lines are carved from one arena: the alternate
+ * screen and the main screen with its history, which takes more lines as
+ * it grows. Both screens are rings of line pointers stored twice in a row,
+ * so a screen is always the contiguous slice ring[head .. head + row - 1].
+ * The history lines of the main screen are the ones before it.
+ *
+ * A resize keeps every line in its arena slot where it can and moves the
+ * ones past the new end into slots of dropped lines. Slots are stride
+ * cells wide, which only changes when the width outgrows it or falls
+ * below half of it; the arena is then restrided in place, with a single
+ * realloc. The byte limit of the history counts whole slots, so after the
+ * window narrows it holds fewer lines than the width would allow.
+ */
+void TerminalEmulator::tarena(int col, int row, int slide)
+{
+    Line *ring, *altring, *alt;
+    Glyph g;
+    Cell blank;
+    int *slot;
+    char *used;
+    int i, x, n, cap, max, len, total, first;
+    int histlen = 0, nalt = 0, nmain = 0;
+    int oldstride = term.stride, stride = term.stride;
+    int mincol = MIN(col, term.col);
+    size_t size, oldsize = (size_t)term.arenacap * oldstride;
+
+    if (col > stride || col < stride / 2)
+        stride = col;
+    /* a history line costs its whole slot and its two ring entries */
+    max = MAX(m_histlines, 0);
+    if (m_histbytes > 0)
+        max = (int)MIN((size_t)max, m_histbytes / (stride * sizeof(Cell) + 2 * sizeof(Line)));
+    cap = max + row;
+
+    if (term.arena)
+    {
+        histlen = MIN(term.histlen + slide, max);
+        nalt = MIN(row, term.row - slide);
+        nmain = histlen + MIN(row, term.row - slide);
+    }
+
+    /* arena slots of the alternate screen, then of the main screen */
+    len = row + histlen + row;
+    slot = (int *)xmalloc(len * sizeof(int));
+    used = (char *)xmalloc(len);
+    memset(used, 0, len);
+
+    /* -1 marks a new line, whose contents are cleared by tresize() */
+    for (i = 0; i < len; i++)
+        slot[i] = -1;
+    alt = IS_SET(MODE_ALTSCREEN) ? term.line : term.alt;
+    for (i = 0; i < nalt; i++)
+        slot[i] = (alt[slide + i] - term.arena) / oldstride;
+    /* screen lines slid off the top join the history */
+    total = term.histlen + slide;
+    first = term.ring ? term.head + term.ringcap - term.histlen : 0;
+    for (i = 0; i < nmain; i++)
+        slot[row + i] = (term.ring[(first + total - histlen + i) % term.ringcap] - term.arena) / oldstride;
+    for (i = 0; i < len; i++)
+    {
+        if (slot[i] >= 0 && slot[i] < len)
+            used[slot[i]] = 1;
+    }
+    /* lines past the new end and new lines take the free slots */
+    for (i = 0, n = 0; i < len; i++)
+    {
+        if (slot[i] >= 0 && slot[i] < len)
+            continue;
+        while (used[n])
+            n++;
+        if (slot[i] >= 0)
+        {
+            memcpy(term.arena + n * oldstride, term.arena + slot[i] * oldstride,
+                   mincol * sizeof(Cell));
+            used[n] = 1;
+        }
+        slot[i] = n++;
+    }
+
+    /*
+     * the arena only shrinks once less than half of it is in use, so
+     * resizing back and forth keeps reusing the same memory, as long as
+     * it is no larger than the arena may grow to with the new limits
+     */
+    size = (size_t)len * stride;
+    if (size < oldsize && size >= oldsize / 2 && oldsize <= (size_t)(cap + row) * stride)
+        size = oldsize;
+    if (stride <= oldstride)
+    {
+        for (i = 0; stride != oldstride && i < len; i++)
+        {
+            if (used[i])
+                memmove(term.arena + i * stride, term.arena + i * oldstride, mincol * sizeof(Cell));
+        }
+        if (size != oldsize)
+            term.arena = (Cell *)xrealloc(term.arena, size * sizeof(Cell));
+    }
+    else
+    {
+        if (size != oldsize)
+            term.arena = (Cell *)xrealloc(term.arena, size * sizeof(Cell));
+        for (i = len - 1; i >= 0; i--)
+        {
+            if (used[i])
+                memmove(term.arena + i * stride, term.arena + i * oldstride, mincol * sizeof(Cell));
+        }
+    }
+
+    ring = (Line *)xmalloc(2 * cap * sizeof(Line));
+    altring = (Line *)xmalloc(2 * row * sizeof(Line));
+    memset(ring, 0, 2 * cap * sizeof(Line));
+    for (i = 0; i < row; i++)
+        altring[i] = altring[i + row] = term.arena + slot[i] * stride;
+    for (n = 0; n < histlen + row; n++)
+        ring[n] = term.arena + slot[row + n] * stride;
+    memcpy(ring + cap, ring, cap * sizeof(Line));
+
+    g.u = ' ';
+    g.mode = 0;
+    g.fg = defaultfg;
+    g.bg = defaultbg;
+    blank = tcell(&g);
+    for (n = 0; n < MIN(histlen, nmain); n++)
+    {
+        for (x = mincol; x < col; x++)
+            ring[n][x] = blank;
+    }
+
+    free(slot);
+    free(used);
+    free(term.ring);
+    free(term.altring);
+
+    if (sel.ob.x != -1 && MIN(sel.ob.y, sel.oe.y) < 0)
+        selclear();
+
+    term.arenacap = size / stride;
+    term.arenalen = len;
+    term.stride = stride;
+    term.ring = ring;
+    term.ringcap = cap;
+    term.head = histlen;
+    term.histlen = histlen;
+    term.histmax = max;
+    term.altring = altring;
+    term.althead = 0;
+    term.scr = 0;
+    if (IS_SET(MODE_ALTSCREEN))
+    {
+        term.line = altring;
+        term.alt = ring + term.head;
+    }
+    else
+    {
+        term.line = ring + term.head;
+        term.alt = altring;
+    }
+}
+
+/* hands out a new main screen line, growing the arena when it is full */
+Line TerminalEmulator::tarenaline()
+{
+    Cell *arena;
+    int i, cap;
+
+    if (term.arenalen == term.arenacap)
+    {
+        cap = MIN(2 * term.arenacap, term.row + term.ringcap);
+        arena = (Cell *)xmalloc(cap * term.stride * sizeof(Cell));
+        memcpy(arena, term.arena, term.arenalen * term.stride * sizeof(Cell));
+        for (i = 0; i < 2 * term.ringcap; i++)
+        {
+            if (term.ring[i])
+                term.ring[i] = arena + (term.ring[i] - term.arena);
+        }
+        for (i = 0; i < 2 * term.row; i++)
+            term.altring[i] = arena + (term.altring[i] - term.arena);
+        free(term.arena);
+        term.arena = arena;
+        term.arenacap = cap;
+    }
+    return term.arena + term.arenalen++ * term.stride;
+}
+
+/* scrolls the whole screen up by moving the ring head */
+void TerminalEmulator::tscrollring(int n)
+{
+    int i, x;
+
+    if (IS_SET(MODE_ALTSCREEN))
+    {
+        term.althead = (term.althead + n) % term.row;
+        term.line = term.altring + term.althead;
+        selscroll(0, -n);
+    }
+    else
+    {
+        for (i = 0; i < n; i++)
+        {
+            term.head = (term.head + 1) % term.ringcap;
+            if (term.histlen < term.histmax)
+                term.histlen++;
+            /* either a free slot or the oldest history line */
+            x = term.head + term.row - 1;
+            if (!term.ring[x])
+            {
+                term.ring[x] = tarenaline();
+                term.ring[x < term.ringcap ? x + term.ringcap : x - term.ringcap] = term.ring[x];
+            }
+        }
+        term.line = term.ring + term.head;
+
+        /* keep a scrolled back view on the same lines */
+        if (term.scr > 0)
+            term.scr = MIN(term.scr + n, term.histlen);
+
+        if (sel.ob.x != -1)
+        {
+            sel.ob.y -= n;
+            sel.oe.y -= n;
+            if (MIN(sel.ob.y, sel.oe.y) < -term.histlen)
+                selclear();
+            else
+                selnormalize();
+        }
+    }
+
+    tsetdirt(0, term.row - 1);
+    tclearregion(0, term.row - n, term.col - 1, term.row - 1);
+}
+
+void TerminalEmulator::hclear()
+{
+    int scr = term.scr;
+
+    term.histlen = 0;
+    tarena(term.col, term.row, 0);
+    if (scr > 0)
+        tfulldirt();
+}
+
 void TerminalEmulator::selscroll(int orig, int n)
 {
     if (sel.ob.x == -1)
@@ -856,37 +1670,6 @@ void TerminalEmulator::tnewline(int first_col)
     tmoveto(first_col ? 0 : term.c.x, y);
 }
 
-void TerminalEmulator::csiparse(void)
-{
-    char *p = csiescseq.buf, *np;
-    long int v;
-
-    csiescseq.narg = 0;
-    if (*p == '?')
-    {
-        csiescseq.priv = 1;
-        p++;
-    }
-
-    csiescseq.buf[csiescseq.len] = '\0';
-    while (p < csiescseq.buf + csiescseq.len)
-    {
-        np = NULL;
-        v = strtol(p, &np, 10);
-        if (np == p)
-            v = 0;
-        if (v == LONG_MAX || v == LONG_MIN)
-            v = -1;
-        csiescseq.arg[csiescseq.narg++] = v;
-        p = np;
-        if (*p != ';' || csiescseq.narg == ESC_ARG_SIZ)
-            break;
-        p++;
-    }
-    csiescseq.mode[0] = *p++;
-    csiescseq.mode[1] = (p < csiescseq.buf + csiescseq.len) ? *p : '\0';
-}
-
 /* for absolute user moves, when decom is set */
 void TerminalEmulator::tmoveato(int x, int y)
 {
@@ -912,8 +1695,145 @@ void TerminalEmulator::tmoveto(int x, int y)
     term.c.y = LIMIT(y, miny, maxy);
 }
 
+Cell TerminalEmulator::tcell(const Glyph *attr)
+{
+#ifdef HEXE_PACKED_CELLS
+    Cell c;
+
+    c.u = attr->u;
+    c.mode = attr->mode;
+    c.style = tstyle(attr->fg, attr->bg);
+    return c;
+#else
+    return *attr;
+#endif
+}
+
+#ifdef HEXE_PACKED_CELLS
+static inline uint32_t
+stylehash(uint32_t fg, uint32_t bg)
+{
+    uint32_t h = fg * 0x9e3779b1u ^ bg * 0x85ebca77u;
+
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    return h ^ (h >> 12);
+}
+
+ushort TerminalEmulator::tstyle(uint32_t fg, uint32_t bg)
+{
+    const Style &last = m_styles[m_lastStyle];
+    size_t i, mask;
+    ushort s;
+
+    /* runs of cells mostly share the colors of the previous one */
+    if (last.fg == fg && last.bg == bg)
+        return m_lastStyle;
+
+    mask = m_styleSlots.size() - 1;
+    for (i = stylehash(fg, bg) & mask; (s = m_styleSlots[i]) != STYLE_NONE; i = (i + 1) & mask)
+    {
+        if (m_styles[s].fg == fg && m_styles[s].bg == bg)
+            return m_lastStyle = s;
+    }
+
+    if (m_styles.size() == STYLE_MAX)
+    {
+        /* the styles are in use, fall back to the default colors */
+        if (m_styleGcDelay-- > 0)
+            return 0;
+        tstylegc();
+        if (m_styles.size() == STYLE_MAX)
+            return 0;
+        return tstyle(fg, bg);
+    }
+
+    s = (ushort)m_styles.size();
+    m_styles.push_back(Style{fg, bg});
+    m_styleSlots[i] = s;
+    if (m_styles.size() * 2 > m_styleSlots.size())
+        tstylerehash(m_styleSlots.size() * 2);
+    return m_lastStyle = s;
+}
+
+void TerminalEmulator::tstylerehash(size_t size)
+{
+    size_t i, mask = size - 1;
+    ushort s;
+
+    m_styleSlots.assign(size, STYLE_NONE);
+    for (s = 0; s < m_styles.size(); s++)
+    {
+        for (i = stylehash(m_styles[s].fg, m_styles[s].bg) & mask; m_styleSlots[i] != STYLE_NONE; i = (i + 1) & mask)
+            ;
+        m_styleSlots[i] = s;
+    }
+}
+
+/* drops the styles no cell refers to, and renumbers the rest */
+void TerminalEmulator::tstylegc()
+{
+    std::vector<ushort> remap(m_styles.size(), 0);
+    Line *alt = IS_SET(MODE_ALTSCREEN) ? term.line : term.alt;
+    Line line;
+    size_t i, n;
+    int y, x;
+
+    /* new lines that are about to be cleared may hold anything */
+    remap[0] = 1;
+    for (y = -term.histlen; y < term.row; y++)
+    {
+        line = term.ring[term.head + term.ringcap + y];
+        for (x = 0; x < term.col; x++)
+        {
+            if (line[x].style < remap.size())
+                remap[line[x].style] = 1;
+        }
+    }
+    for (y = 0; y < term.row; y++)
+    {
+        for (x = 0; x < term.col; x++)
+        {
+            if (alt[y][x].style < remap.size())
+                remap[alt[y][x].style] = 1;
+        }
+    }
+
+    for (i = 0, n = 0; i < m_styles.size(); i++)
+    {
+        if (!remap[i])
+            continue;
+        remap[i] = (ushort)n;
+        m_styles[n++] = m_styles[i];
+    }
+    m_styles.resize(n);
+    m_lastStyle = 0;
+    tstylerehash(m_styleSlots.size());
+
+    /*
+     * When little was freed, let a share of the cells be rewritten with the
+     * default colors before scanning again, so the scans stay amortized.
+     */
+    if (n > STYLE_MAX - STYLE_MAX / 16)
+        m_styleGcDelay = (term.histlen + 2 * term.row) * term.col / 16;
+
+    for (y = -term.histlen; y < term.row; y++)
+    {
+        line = term.ring[term.head + term.ringcap + y];
+        for (x = 0; x < term.col; x++)
+            line[x].style = line[x].style < remap.size() ? remap[line[x].style] : 0;
+    }
+    for (y = 0; y < term.row; y++)
+    {
+        for (x = 0; x < term.col; x++)
+            alt[y][x].style = alt[y][x].style < remap.size() ? remap[alt[y][x].style] : 0;
+    }
+}
+#endif
+
 void TerminalEmulator::tsetchar(Rune u, Glyph *attr, int x, int y)
 {
+    Cell c;
     static const char *vt100_0[62] = {
         /* 0x41 - 0x7e */
         "↑", "↓", "→", "←", "█", "▚", "☃",      /* A - G */
@@ -933,32 +1853,46 @@ void TerminalEmulator::tsetchar(Rune u, Glyph *attr, int x, int y)
         BETWEEN(u, 0x41, 0x7e) && vt100_0[u - 0x41])
         utf8decode(vt100_0[u - 0x41], &u, UTF_SIZ);
 
+    c = tcell(attr);
+    c.u = u;
+    if (isboxdraw(u))
+        c.mode |= ATTR_BOXDRAW;
+
+    if (m_diffDamage && !ISDIRTY(y, x, x + 1))
+    {
+        m_damageChecks++;
+        if (CELLEQ(term.line[y][x], c))
+        {
+            m_damageHits++;
+            return;
+        }
+    }
+
+    /* erasing only one half of a wide character leaves the other, which has nothing to split */
     if (term.line[y][x].mode & ATTR_WIDE)
     {
-        if (x + 1 < term.col)
+        if (x + 1 < term.col && term.line[y][x + 1].mode & ATTR_WDUMMY)
         {
             term.line[y][x + 1].u = ' ';
             term.line[y][x + 1].mode &= ~ATTR_WDUMMY;
         }
     }
-    else if (term.line[y][x].mode & ATTR_WDUMMY)
+    else if (term.line[y][x].mode & ATTR_WDUMMY && x > 0 && term.line[y][x - 1].mode & ATTR_WIDE)
     {
         term.line[y][x - 1].u = ' ';
         term.line[y][x - 1].mode &= ~ATTR_WIDE;
     }
 
-    term.dirty[y] = 1;
-    term.line[y][x] = *attr;
-    term.line[y][x].u = u;
-
-    if (isboxdraw(u))
-        term.line[y][x].mode |= ATTR_BOXDRAW;
+    /* the halves of a wide character next to it may change */
+    tsetdirtcols(y, x - 1, x + 2);
+    term.line[y][x] = c;
 }
 
 void TerminalEmulator::tclearregion(int x1, int y1, int x2, int y2)
 {
-    int x, y, temp;
-    Glyph *gp;
+    int x, y, temp, lo, hi;
+    Glyph g;
+    Cell blank, *cp;
 
     if (x1 > x2)
         temp = x1, x1 = x2, x2 = temp;
@@ -970,26 +1904,44 @@ void TerminalEmulator::tclearregion(int x1, int y1, int x2, int y2)
     LIMIT(y1, 0, term.row - 1);
     LIMIT(y2, 0, term.row - 1);
 
+    g.u = ' ';
+    g.mode = 0;
+    g.fg = term.c.attr.fg;
+    g.bg = term.c.attr.bg;
+    blank = tcell(&g);
     for (y = y1; y <= y2; y++)
     {
-        term.dirty[y] = 1;
-        for (x = x1; x <= x2; x++)
+        cp = term.line[y];
+        for (x = x1; sel.ob.x != -1 && x <= x2; x++)
         {
-            gp = &term.line[y][x];
             if (selected(x, y))
                 selclear();
-            gp->fg = term.c.attr.fg;
-            gp->bg = term.c.attr.bg;
-            gp->mode = 0;
-            gp->u = ' ';
         }
+
+        lo = x1;
+        hi = x2;
+        if (m_diffDamage && !ISDIRTY(y, x1, x2 + 1))
+        {
+            /* only the cells between the first and last change are damaged */
+            lo += cellspan(cp + x1, x2 - x1 + 1, &blank);
+            while (hi >= lo && CELLEQ(cp[hi], blank))
+                hi--;
+            m_damageChecks += x2 - x1 + 1;
+            m_damageHits += (x2 - x1) - (hi - lo);
+            if (hi < lo)
+                continue;
+        }
+
+        tsetdirtcols(y, lo, hi + 1);
+        for (x = lo; x <= hi; x++)
+            cp[x] = blank;
     }
 }
 
 void TerminalEmulator::tdeletechar(int n)
 {
     int dst, src, size;
-    Glyph *line;
+    Cell *line;
 
     LIMIT(n, 0, term.col - term.c.x);
 
@@ -998,14 +1950,15 @@ void TerminalEmulator::tdeletechar(int n)
     size = term.col - src;
     line = term.line[term.c.y];
 
-    memmove(&line[dst], &line[src], size * sizeof(Glyph));
+    memmove(&line[dst], &line[src], size * sizeof(Cell));
+    tsetdirtcols(term.c.y, dst, term.col);
     tclearregion(term.col - n, term.c.y, term.col - 1, term.c.y);
 }
 
 void TerminalEmulator::tinsertblank(int n)
 {
     int dst, src, size;
-    Glyph *line;
+    Cell *line;
 
     LIMIT(n, 0, term.col - term.c.x);
 
@@ -1014,7 +1967,8 @@ void TerminalEmulator::tinsertblank(int n)
     size = term.col - dst;
     line = term.line[term.c.y];
 
-    memmove(&line[dst], &line[src], size * sizeof(Glyph));
+    memmove(&line[dst], &line[src], size * sizeof(Cell));
+    tsetdirtcols(term.c.y, src, term.col);
     tclearregion(src, term.c.y, dst - 1, term.c.y);
 }
 
@@ -1031,10 +1985,55 @@ void TerminalEmulator::tdeleteline(int n)
 }
 
 int32_t
-TerminalEmulator::tdefcolor(int *attr, int *npar, int l)
+TerminalEmulator::tdefcolor(int *attr, uint32_t sub, int *npar, int l)
 {
     int32_t idx = -1;
     uint r, g, b;
+    int first, n;
+
+    /* ISO 8613-6 form: 38:2:[<colorspace>]:r:g:b or 38:5:<index> */
+    first = *npar + 1;
+    if (first < l && sub & 1u << first)
+    {
+        for (n = 0; first + n < l && sub & 1u << (first + n); n++)
+            ;
+        *npar += n;
+
+        switch (attr[first])
+        {
+        case 2: /* direct color in RGB space */
+            if (n < 4)
+            {
+                fprintf(stderr, "erresc(38): Incorrect number of sub-parameters (%d)\n", n);
+                break;
+            }
+            /* the colorspace id is optional */
+            first += (n >= 5) ? 2 : 1;
+            r = attr[first];
+            g = attr[first + 1];
+            b = attr[first + 2];
+            if (!BETWEEN(r, 0, 255) || !BETWEEN(g, 0, 255) || !BETWEEN(b, 0, 255))
+                fprintf(stderr, "erresc: bad rgb color (%u,%u,%u)\n", r, g, b);
+            else
+                idx = TRUECOLOR(r, g, b);
+            break;
+        case 5: /* indexed color */
+            if (n < 2)
+            {
+                fprintf(stderr, "erresc(38): Incorrect number of sub-parameters (%d)\n", n);
+                break;
+            }
+            if (!BETWEEN(attr[first + 1], 0, 255))
+                fprintf(stderr, "erresc: bad fgcolor %d\n", attr[first + 1]);
+            else
+                idx = attr[first + 1];
+            break;
+        default:
+            fprintf(stderr, "erresc(38): gfx attr %d unknown\n", attr[first]);
+            break;
+        }
+        return idx;
+    }
 
     switch (attr[*npar + 1])
     {
@@ -1083,7 +2082,7 @@ TerminalEmulator::tdefcolor(int *attr, int *npar, int l)
     return idx;
 }
 
-void TerminalEmulator::tsetattr(int *attr, int l)
+void TerminalEmulator::tsetattr(int *attr, uint32_t sub, int l)
 {
     int i;
     int32_t idx;
@@ -1115,7 +2114,11 @@ void TerminalEmulator::tsetattr(int *attr, int l)
             term.c.attr.mode |= ATTR_ITALIC;
             break;
         case 4:
-            term.c.attr.mode |= ATTR_UNDERLINE;
+            /* 4:0 turns underline off, other styles are drawn as single */
+            if (i + 1 < l && sub & 1u << (i + 1) && attr[i + 1] == 0)
+                term.c.attr.mode &= ~ATTR_UNDERLINE;
+            else
+                term.c.attr.mode |= ATTR_UNDERLINE;
             break;
         case 5: /* slow blink */
                 /* FALLTHROUGH */
@@ -1153,14 +2156,14 @@ void TerminalEmulator::tsetattr(int *attr, int l)
             term.c.attr.mode &= ~ATTR_STRUCK;
             break;
         case 38:
-            if ((idx = tdefcolor(attr, &i, l)) >= 0)
+            if ((idx = tdefcolor(attr, sub, &i, l)) >= 0)
                 term.c.attr.fg = idx;
             break;
         case 39:
             term.c.attr.fg = defaultfg;
             break;
         case 48:
-            if ((idx = tdefcolor(attr, &i, l)) >= 0)
+            if ((idx = tdefcolor(attr, sub, &i, l)) >= 0)
                 term.c.attr.bg = idx;
             break;
         case 49:
@@ -1192,6 +2195,10 @@ void TerminalEmulator::tsetattr(int *attr, int l)
             }
             break;
         }
+
+        /* skip sub-parameters of attributes that take none */
+        while (i + 1 < l && sub & 1u << (i + 1))
+            i++;
     }
 }
 
@@ -1354,6 +2361,10 @@ void TerminalEmulator::csihandle(void)
 
     std::shared_ptr<TerminalDisplay> dpy{};
 
+    /* only DEC private modes are understood */
+    if (csiescseq.priv && csiescseq.priv != '?')
+        goto unknown;
+
     switch (csiescseq.mode[0])
     {
     default:
@@ -1469,6 +2480,9 @@ void TerminalEmulator::csihandle(void)
         case 2: /* all */
             tclearregion(0, 0, term.col - 1, term.row - 1);
             break;
+        case 3: /* scrollback */
+            hclear();
+            break;
         default:
             goto unknown;
         }
@@ -1528,7 +2542,7 @@ void TerminalEmulator::csihandle(void)
         tsetmode(csiescseq.priv, 1, csiescseq.arg, csiescseq.narg);
         break;
     case 'm': /* SGR -- Terminal attribute (color) */
-        tsetattr(csiescseq.arg, csiescseq.narg);
+        tsetattr(csiescseq.arg, csiescseq.sub, csiescseq.narg);
         break;
     case 'n': /* DSR – Device Status Report (cursor position) */
         if (csiescseq.arg[0] == 6)
@@ -1564,7 +2578,9 @@ void TerminalEmulator::csihandle(void)
             if (csiescseq.arg[0] < 0 || csiescseq.arg[0] < cursor_mode::MAX_CURSOR)
                 goto unknown;
             dpy = m_dpy.lock();
-            dpy->SetCursorMode((cursor_mode)csiescseq.arg[0]);
+            if (dpy)
+                dpy->SetCursorMode((cursor_mode)csiescseq.arg[0]);
+            m_redraw = true;
             break;
         default:
             goto unknown;
@@ -1575,34 +2591,20 @@ void TerminalEmulator::csihandle(void)
 
 void TerminalEmulator::csidump(void)
 {
-    size_t i;
-    uint c;
+    int i;
 
+    /* the raw bytes are not kept, so print the parsed sequence */
     fprintf(stderr, "ESC[");
-    for (i = 0; i < csiescseq.len; i++)
+    if (csiescseq.priv)
+        putc(csiescseq.priv, stderr);
+    for (i = 0; i < csiescseq.narg; i++)
     {
-        c = csiescseq.buf[i] & 0xff;
-        if (isprint(c))
-        {
-            putc(c, stderr);
-        }
-        else if (c == '\n')
-        {
-            fprintf(stderr, "(\\n)");
-        }
-        else if (c == '\r')
-        {
-            fprintf(stderr, "(\\r)");
-        }
-        else if (c == 0x1b)
-        {
-            fprintf(stderr, "(\\e)");
-        }
-        else
-        {
-            fprintf(stderr, "(%02x)", c);
-        }
+        if (i > 0)
+            putc((csiescseq.sub & 1u << i) ? ':' : ';', stderr);
+        fprintf(stderr, "%d", csiescseq.arg[i]);
     }
+    for (i = 0; i < 2 && csiescseq.mode[i]; i++)
+        putc(csiescseq.mode[i], stderr);
     putc('\n', stderr);
 }
 
@@ -1616,30 +2618,32 @@ void TerminalEmulator::strhandle(void)
     char *p = NULL, *dec;
     int j, narg, par;
 
-    term.esc &= ~(ESC_STR_END | ESC_STR);
     strparse();
     par = (narg = strescseq.narg) ? atoi(strescseq.args[0]) : 0;
 
     std::shared_ptr<TerminalDisplay> dpy = m_dpy.lock();
 
+    /* titles, colors and the clipboard reach the display with the next frame */
+    m_redraw = true;
+
     switch (strescseq.type)
     {
     case ']': /* OSC -- Operating System Command */
         switch (par)
         {
         case 0:
-            if (narg > 1)
+            if (narg > 1 && dpy)
             {
                 dpy->SetTitle(strescseq.args[1]);
                 dpy->SetIconTitle(strescseq.args[1]);
             }
             return;
         case 1:
-            if (narg > 1)
+            if (narg > 1 && dpy)
                 dpy->SetIconTitle(strescseq.args[1]);
             return;
         case 2:
-            if (narg > 1)
+            if (narg > 1 && dpy)
             {
                 dpy->SetTitle(strescseq.args[1]);
             }
@@ -1684,7 +2688,8 @@ void TerminalEmulator::strhandle(void)
         }
         break;
     case 'k': /* old title set compatibility */
-        dpy->SetTitle(strescseq.args[0]);
+        if (dpy)
+            dpy->SetTitle(strescseq.args[0]);
         return;
     case 'P': /* DCS -- Device Control String */
     case '_': /* APC -- Application Program Command */
@@ -1811,7 +2816,7 @@ void TerminalEmulator::tdumpsel(void)
 void TerminalEmulator::tdumpline(int n)
 {
     char buf[UTF_SIZ];
-    Glyph *bp, *end;
+    Cell *bp, *end;
 
     bp = &term.line[n][0];
     end = &bp[MIN(tlinelen(n), term.col) - 1];
@@ -1904,10 +2909,12 @@ void TerminalEmulator::tstrsequence(uchar c)
     case 0x9d: /* OSC -- Operating System Command */
         c = ']';
         break;
+    case 0x98: /* SOS -- Start of String */
+        c = 'X';
+        break;
     }
     strreset();
     strescseq.type = c;
-    term.esc |= ESC_STR;
 }
 
 void TerminalEmulator::tcontrolcode(uchar ascii)
@@ -1930,22 +2937,12 @@ void TerminalEmulator::tcontrolcode(uchar ascii)
         tnewline(IS_SET(MODE_CRLF));
         return;
     case '\a': /* BEL */
-        if (term.esc & ESC_STR_END)
-        {
-            /* backwards compatibility to xterm */
-            strhandle();
-        }
-        else
-        {
-            auto belDpyPtr = m_dpy.lock();
+    {
+        auto belDpyPtr = m_dpy.lock();
+        if (belDpyPtr)
             belDpyPtr->Bell();
-        }
-        break;
-    case '\033': /* ESC */
-        csireset();
-        term.esc &= ~(ESC_CSI | ESC_ALTCHARSET | ESC_TEST);
-        term.esc |= ESC_START;
         return;
+    }
     case '\016': /* SO (LS1 -- Locking shift 1) */
     case '\017': /* SI (LS0 -- Locking shift 0) */
         term.charset = 1 - (ascii - '\016');
@@ -1954,8 +2951,7 @@ void TerminalEmulator::tcontrolcode(uchar ascii)
         tsetchar('?', &term.c.attr, term.c.x, term.c.y);
         /* FALLTHROUGH */
     case '\030': /* CAN */
-        csireset();
-        break;
+        return;
     case '\005': /* ENQ (IGNORED) */
     case '\000': /* NUL (IGNORED) */
     case '\021': /* XON (IGNORED) */
@@ -1991,61 +2987,50 @@ void TerminalEmulator::tcontrolcode(uchar ascii)
     case 0x95: /* TODO: MW */
     case 0x96: /* TODO: SPA */
     case 0x97: /* TODO: EPA */
-    case 0x98: /* TODO: SOS */
     case 0x99: /* TODO: SGCI */
         break;
     case 0x9a: /* DECID -- Identify Terminal */
         ttywrite(vtiden, strlen(vtiden), 0);
         break;
-    case 0x9b: /* TODO: CSI */
-    case 0x9c: /* TODO: ST */
-        break;
-    case 0x90: /* DCS -- Device Control String */
-    case 0x9d: /* OSC -- Operating System Command */
-    case 0x9e: /* PM -- Privacy Message */
-    case 0x9f: /* APC -- Application Program Command */
-        tstrsequence(ascii);
-        return;
     }
-    /* only CAN, SUB, \a and C1 chars interrupt a sequence */
-    term.esc &= ~(ESC_STR_END | ESC_STR);
+    /* ESC, CSI, ST and the string introducers are handled by the parser */
 }
 
 /*
- * returns 1 when the sequence is finished and it hasn't to read
- * more characters for this sequence, otherwise 0
+ * Dispatch an escape sequence that is not a CSI or a string, i.e. ESC
+ * followed by an optional intermediate byte and a final byte.
  */
-int TerminalEmulator::eschandle(uchar ascii)
+void TerminalEmulator::eschandle(uchar ascii)
 {
-    switch (ascii)
+    switch (csiescseq.ninter > 1 ? -1 : csiescseq.inter)
     {
-    case '[':
-        term.esc |= ESC_CSI;
-        return 0;
+    case '\0':
+        break;
     case '#':
-        term.esc |= ESC_TEST;
-        return 0;
+        tdectest(ascii);
+        return;
     case '%':
-        term.esc |= ESC_UTF8;
-        return 0;
-    case 'P': /* DCS -- Device Control String */
-    case '_': /* APC -- Application Program Command */
-    case '^': /* PM -- Privacy Message */
-    case ']': /* OSC -- Operating System Command */
-    case 'k': /* old title set compatibility */
-        tstrsequence(ascii);
-        return 0;
-    case 'n': /* LS2 -- Locking shift 2 */
-    case 'o': /* LS3 -- Locking shift 3 */
-        term.charset = 2 + (ascii - 'n');
-        break;
+        tdefutf8(ascii);
+        return;
     case '(': /* GZD4 -- set primary charset G0 */
     case ')': /* G1D4 -- set secondary charset G1 */
     case '*': /* G2D4 -- set tertiary charset G2 */
     case '+': /* G3D4 -- set quaternary charset G3 */
-        term.icharset = ascii - '(';
-        term.esc |= ESC_ALTCHARSET;
-        return 0;
+        term.icharset = csiescseq.inter - '(';
+        tdeftran(ascii);
+        return;
+    default:
+        fprintf(stderr, "erresc: unknown sequence ESC %c 0x%02X '%c'\n",
+                csiescseq.inter, (uchar)ascii, isprint(ascii) ? ascii : '.');
+        return;
+    }
+
+    switch (ascii)
+    {
+    case 'n': /* LS2 -- Locking shift 2 */
+    case 'o': /* LS3 -- Locking shift 3 */
+        term.charset = 2 + (ascii - 'n');
+        break;
     case 'D': /* IND -- Linefeed */
         if (term.c.y == term.bot)
         {
@@ -2092,118 +3077,222 @@ int TerminalEmulator::eschandle(uchar ascii)
     case '8': /* DECRC -- Restore Cursor */
         tcursor(CURSOR_LOAD);
         break;
-    case '\\': /* ST -- String Terminator */
-        if (term.esc & ESC_STR_END)
-            strhandle();
+    case '\\': /* ST -- String Terminator, without a string */
         break;
     default:
         fprintf(stderr, "erresc: unknown sequence ESC 0x%02X '%c'\n",
                 (uchar)ascii, isprint(ascii) ? ascii : '.');
         break;
     }
-    return 1;
 }
 
-static const unsigned char table[] = {
-#include "nonspacing.h"
+/*
+ * Escape sequence parser, after the DEC/ANSI parser model by Paul Flo
+ * Williams. Every rune is looked up in a transition table indexed by the
+ * current state and the rune (anything from 0xa0 up shares the last
+ * column), which yields the action to perform and the next state.
+ */
+enum parse_action
+{
+    PA_NONE = 0,     /* ignore the rune */
+    PA_PRINT,        /* put the rune on the screen */
+    PA_EXECUTE,      /* C0 or C1 control function */
+    PA_CLEAR,        /* start of a new sequence */
+    PA_COLLECT,      /* intermediate byte */
+    PA_PRIVATE,      /* CSI private marker */
+    PA_PARAM,        /* CSI parameter digit or separator */
+    PA_ESC_DISPATCH, /* final byte of an ESC sequence */
+    PA_CSI_DISPATCH, /* final byte of a CSI sequence */
+    PA_STR_START,    /* DCS, OSC, PM, APC, SOS or old title set */
+    PA_STR_PUT,      /* rune inside of a string */
+    PA_STR_DISPATCH, /* string terminated */
 };
 
-static const unsigned char wtable[] = {
-#include "wide.h"
-};
+#define PARSE_CLASSES 0xa1
+#define PARSE_CLASS(u) ((u) < 0xa0 ? (u) : 0xa0)
 
-static int Hexe_wcwidth(Rune wc)
+typedef struct
 {
-    if (wc < 0xffU)
-        return (wc + 1 & 0x7f) >= 0x21 ? 1 : wc ? -1 : 0;
+    uchar entry[ESC_STATE_COUNT][PARSE_CLASSES]; /* action << 4 | state */
+} ParseTable;
 
-    if (is_emoji(wc))
-        return 2;
+static constexpr void
+parserange(ParseTable &t, int state, int lo, int hi, int action, int next)
+{
+    for (int c = lo; c <= hi; c++)
+        t.entry[state][c] = (uchar)(action << 4 | next);
+}
+
+static constexpr ParseTable
+parsetablebuild()
+{
+    ParseTable t{};
+    int s = 0;
 
-    if ((wc & 0xfffeffffU) < 0xfffe)
+    /* ground */
+    parserange(t, ESC_GROUND, 0x00, 0x1f, PA_EXECUTE, ESC_GROUND);
+    parserange(t, ESC_GROUND, 0x20, 0x7e, PA_PRINT, ESC_GROUND);
+    parserange(t, ESC_GROUND, 0x7f, 0x7f, PA_EXECUTE, ESC_GROUND);
+    parserange(t, ESC_GROUND, 0xa0, 0xa0, PA_PRINT, ESC_GROUND);
+
+    /* ESC and ESC with intermediates */
+    for (s = ESC_ESCAPE; s <= ESC_INTERMEDIATE; s++)
     {
-        if ((table[table[wc >> 8] * 32 + ((wc & 255) >> 3)] >> (wc & 7)) & 1)
-            return 0;
-        if ((wtable[wtable[wc >> 8] * 32 + ((wc & 255) >> 3)] >> (wc & 7)) & 1)
-            return 2;
-        return 1;
+        parserange(t, s, 0x00, 0x1f, PA_EXECUTE, s);
+        parserange(t, s, 0x20, 0x2f, PA_COLLECT, ESC_INTERMEDIATE);
+        parserange(t, s, 0x30, 0x7e, PA_ESC_DISPATCH, ESC_GROUND);
+        parserange(t, s, 0x7f, 0x7f, PA_NONE, s);
+        parserange(t, s, 0xa0, 0xa0, PA_NONE, ESC_GROUND);
     }
+    parserange(t, ESC_ESCAPE, '[', '[', PA_CLEAR, ESC_CSI_ENTRY);
+    parserange(t, ESC_ESCAPE, 'P', 'P', PA_STR_START, ESC_STR);
+    parserange(t, ESC_ESCAPE, 'X', 'X', PA_STR_START, ESC_STR);
+    parserange(t, ESC_ESCAPE, ']', ']', PA_STR_START, ESC_STR);
+    parserange(t, ESC_ESCAPE, '^', '_', PA_STR_START, ESC_STR);
+    parserange(t, ESC_ESCAPE, 'k', 'k', PA_STR_START, ESC_STR);
 
-    if ((wc & 0xfffe) == 0xfffe)
-        return -1;
-    if (wc - 0x20000U < 0x20000)
-        return 2;
-    if (wc == 0xe0001 || wc - 0xe0020U < 0x5f || wc - 0xe0100 < 0xef)
-        return 0;
+    /* CSI */
+    for (s = ESC_CSI_ENTRY; s <= ESC_CSI_IGNORE; s++)
+    {
+        parserange(t, s, 0x00, 0x1f, PA_EXECUTE, s);
+        parserange(t, s, 0x20, 0x2f, PA_COLLECT, ESC_CSI_INTERMEDIATE);
+        parserange(t, s, 0x30, 0x3b, PA_PARAM, ESC_CSI_PARAM);
+        parserange(t, s, 0x3c, 0x3f, PA_NONE, ESC_CSI_IGNORE);
+        parserange(t, s, 0x40, 0x7e, PA_CSI_DISPATCH, ESC_GROUND);
+        parserange(t, s, 0x7f, 0x7f, PA_NONE, s);
+        parserange(t, s, 0xa0, 0xa0, PA_NONE, ESC_CSI_IGNORE);
+    }
+    parserange(t, ESC_CSI_ENTRY, 0x3c, 0x3f, PA_PRIVATE, ESC_CSI_PARAM);
+    parserange(t, ESC_CSI_INTERMEDIATE, 0x30, 0x3f, PA_NONE, ESC_CSI_IGNORE);
+    parserange(t, ESC_CSI_IGNORE, 0x20, 0x3f, PA_NONE, ESC_CSI_IGNORE);
+    parserange(t, ESC_CSI_IGNORE, 0x40, 0x7e, PA_NONE, ESC_GROUND);
 
-    return 1;
-}
+    /*
+     * Strings take everything up to a terminator, including C0 controls,
+     * as st always did. An ESC may be the start of ST, so it is remembered
+     * in ESC_STR_END, which otherwise behaves like ESC_ESCAPE, except that
+     * C0 controls between the ESC and the backslash don't lose the string.
+     */
+    parserange(t, ESC_STR, 0x00, 0x7f, PA_STR_PUT, ESC_STR);
+    parserange(t, ESC_STR, 0xa0, 0xa0, PA_STR_PUT, ESC_STR);
+    parserange(t, ESC_STR, '\a', '\a', PA_STR_DISPATCH, ESC_GROUND);
+    for (int c = 0; c < PARSE_CLASSES; c++)
+        t.entry[ESC_STR_END][c] = t.entry[ESC_ESCAPE][c];
+    parserange(t, ESC_STR_END, 0x00, 0x1f, PA_EXECUTE, ESC_STR_END);
+    parserange(t, ESC_STR_END, '\\', '\\', PA_STR_DISPATCH, ESC_GROUND);
+    parserange(t, ESC_STR_END, '\a', '\a', PA_STR_DISPATCH, ESC_GROUND);
+
+    /* transitions from anywhere */
+    for (s = 0; s < ESC_STATE_COUNT; s++)
+    {
+        parserange(t, s, 0x18, 0x18, PA_EXECUTE, ESC_GROUND); /* CAN */
+        parserange(t, s, 0x1a, 0x1a, PA_EXECUTE, ESC_GROUND); /* SUB */
+        parserange(t, s, 0x1b, 0x1b, PA_CLEAR, ESC_ESCAPE);
+        parserange(t, s, 0x80, 0x9f, PA_EXECUTE, ESC_GROUND);
+        parserange(t, s, 0x90, 0x90, PA_STR_START, ESC_STR);  /* DCS */
+        parserange(t, s, 0x98, 0x98, PA_STR_START, ESC_STR);  /* SOS */
+        parserange(t, s, 0x9b, 0x9b, PA_CLEAR, ESC_CSI_ENTRY); /* CSI */
+        parserange(t, s, 0x9c, 0x9c, PA_NONE, ESC_GROUND);     /* ST */
+        parserange(t, s, 0x9d, 0x9f, PA_STR_START, ESC_STR);  /* OSC, PM, APC */
+    }
+    parserange(t, ESC_STR, 0x1b, 0x1b, PA_CLEAR, ESC_STR_END);
+    parserange(t, ESC_STR, 0x9c, 0x9c, PA_STR_DISPATCH, ESC_GROUND);
+
+    return t;
+}
+
+static constexpr ParseTable parsetable = parsetablebuild();
 
 void TerminalEmulator::tputc(Rune u)
 {
     char c[UTF_SIZ];
-    int control;
     int width;
     size_t len;
-    Glyph *gp;
-
-    control = ISCONTROL(u);
-    if (u < 127 || !IS_SET(MODE_UTF8))
-    {
-        c[0] = u;
-        width = (int)(len = 1);
-    }
-    else
-    {
-        len = utf8encode(u, c);
-        //if (!control && (width = wcwidth9(u)) < 0) {
-        if (!control && (width = Hexe_wcwidth(u)) < 0)
-        {
-            if (width == -1)
-            {
-                width = 0;
-            }
-            else
-            {
-                width = 1;
-            }
-        }
-    }
+    Cell *gp;
+    uchar entry, props;
 
     if (IS_SET(MODE_PRINT))
-        tprinter(c, len);
+        tprinter(c, runeencode(u, c, IS_SET(MODE_UTF8)));
 
     /*
-	 * STR sequence must be checked before anything else
-	 * because it uses all following characters until it
-	 * receives a ESC, a SUB, a ST or any other C1 control
-	 * character.
-	 */
-    if (term.esc & ESC_STR)
+     * The next state is set before the action runs, since dispatching may
+     * print (REP) or reset the terminal.
+     */
+    entry = parsetable.entry[term.esc][PARSE_CLASS(u)];
+    term.esc = entry & 0xf;
+
+    switch (entry >> 4)
     {
-        if (u == '\a' || u == 030 || u == 032 || u == 033 ||
-            ISCONTROLC1(u))
+    case PA_NONE:
+        return;
+    case PA_PRINT:
+        break;
+    case PA_EXECUTE:
+        /*
+         * Actions of control codes must be performed as soon they arrive
+         * because they can be embedded inside a control sequence, and
+         * they must not cause conflicts with sequences.
+         */
+        tcontrolcode(u);
+        /*
+         * control codes are not shown ever
+         */
+        if (term.esc == ESC_GROUND)
+            term.lastc = 0;
+        return;
+    case PA_CLEAR:
+        csireset();
+        return;
+    case PA_COLLECT:
+        if (csiescseq.ninter++ == 0)
+            csiescseq.inter = u;
+        else if (term.esc == ESC_CSI_INTERMEDIATE)
+            term.esc = ESC_CSI_IGNORE;
+        return;
+    case PA_PRIVATE:
+        csiescseq.priv = u;
+        return;
+    case PA_PARAM:
+        /* csiescseq.narg is the index of the current argument here */
+        if (u == ';' || u == ':')
         {
-            term.esc &= ~(ESC_START | ESC_STR);
-            term.esc |= ESC_STR_END;
-            goto check_control_code;
+            if (csiescseq.narg < ESC_ARG_SIZ && ++csiescseq.narg < ESC_ARG_SIZ && u == ':')
+                csiescseq.sub |= 1u << csiescseq.narg;
         }
-
+        else if (csiescseq.narg < ESC_ARG_SIZ)
+        {
+            csiescseq.arg[csiescseq.narg] = MIN(csiescseq.arg[csiescseq.narg] * 10 + (int)(u - '0'), 65535);
+        }
+        return;
+    case PA_ESC_DISPATCH:
+        eschandle(u);
+        return;
+    case PA_CSI_DISPATCH:
+        csiescseq.narg = MIN(csiescseq.narg + 1, ESC_ARG_SIZ);
+        csiescseq.mode[0] = csiescseq.ninter ? csiescseq.inter : u;
+        csiescseq.mode[1] = csiescseq.ninter ? u : '\0';
+        csihandle();
+        return;
+    case PA_STR_START:
+        tstrsequence(u);
+        return;
+    case PA_STR_PUT:
+        len = runeencode(u, c, IS_SET(MODE_UTF8));
         if (strescseq.len + len >= strescseq.siz)
         {
             /*
-			 * Here is a bug in terminals. If the user never sends
-			 * some code to stop the str or esc command, then st
-			 * will stop responding. But this is better than
-			 * silently failing with unknown characters. At least
-			 * then users will report back.
-			 *
-			 * In the case users ever get fixed, here is the code:
-			 */
+             * Here is a bug in terminals. If the user never sends
+             * some code to stop the str or esc command, then st
+             * will stop responding. But this is better than
+             * silently failing with unknown characters. At least
+             * then users will report back.
+             *
+             * In the case users ever get fixed, here is the code:
+             */
             /*
-			 * term.esc = 0;
-			 * strhandle();
-			 */
+             * term.esc = 0;
+             * strhandle();
+             */
             if (strescseq.siz > (SIZE_MAX - UTF_SIZ) / 2)
                 return;
             strescseq.siz *= 2;
@@ -2213,62 +3302,14 @@ void TerminalEmulator::tputc(Rune u)
         memmove(&strescseq.buf[strescseq.len], c, len);
         strescseq.len += len;
         return;
-    }
-
-check_control_code:
-    /*
-	 * Actions of control codes must be performed as soon they arrive
-	 * because they can be embedded inside a control sequence, and
-	 * they must not cause conflicts with sequences.
-	 */
-    if (control)
-    {
-        tcontrolcode(u);
-        /*
-		 * control codes are not shown ever
-		 */
-        if (!term.esc)
-            term.lastc = 0;
-        return;
-    }
-    else if (term.esc & ESC_START)
-    {
-        if (term.esc & ESC_CSI)
-        {
-            csiescseq.buf[csiescseq.len++] = u;
-            if (BETWEEN(u, 0x40, 0x7E) || csiescseq.len >= sizeof(csiescseq.buf) - 1)
-            {
-                term.esc = 0;
-                csiparse();
-                csihandle();
-            }
-            return;
-        }
-        else if (term.esc & ESC_UTF8)
-        {
-            tdefutf8(u);
-        }
-        else if (term.esc & ESC_ALTCHARSET)
-        {
-            tdeftran(u);
-        }
-        else if (term.esc & ESC_TEST)
-        {
-            tdectest(u);
-        }
-        else
-        {
-            if (!eschandle(u))
-                return;
-            /* sequence already finished */
-        }
-        term.esc = 0;
-        /*
-		 * All characters which form part of a sequence are not
-		 * printed
-		 */
+    case PA_STR_DISPATCH:
+        strhandle();
         return;
     }
+
+    props = runeprops(u);
+    width = props & RUNE_WIDTH;
+
     if (selected(term.c.x, term.c.y))
         selclear();
 
@@ -2281,7 +3322,10 @@ check_control_code:
     }
 
     if (IS_SET(MODE_INSERT) && term.c.x + width < term.col)
-        memmove(gp + width, gp, (term.col - term.c.x - width) * sizeof(Glyph));
+    {
+        memmove(gp + width, gp, (term.col - term.c.x - width) * sizeof(Cell));
+        tsetdirtcols(term.c.y, term.c.x, term.col);
+    }
 
     if (term.c.x + width > term.col)
     {
@@ -2300,7 +3344,7 @@ check_control_code:
             gp[1].u = '\0';
             gp[1].mode = ATTR_WDUMMY;
         }
-        if (is_emoji(u))
+        if (props & RUNE_EMOJI)
         {
             gp->mode |= ATTR_EMOJI;
         }
@@ -2316,43 +3360,151 @@ check_control_code:
     }
 }
 
-int TerminalEmulator::twrite(const char *buf, int buflen, int show_ctrl)
+/*
+ * Bulk version of tputc() for a run of printable runes that take one
+ * column each. The caller makes sure no escape sequence is pending and
+ * that none of the modes that need per character work (print, insert, no
+ * wrap, DEC graphics) are active.
+ */
+void TerminalEmulator::twritenarrow(const Rune *s, int n)
 {
-    size_t charsize;
+    Cell c, *line;
+    int x, y, i, len, lo, hi;
+
+    while (n > 0)
+    {
+        if (term.c.state & CURSOR_WRAPNEXT)
+        {
+            term.line[term.c.y][term.c.x].mode |= ATTR_WRAP;
+            tnewline(1);
+        }
+
+        x = term.c.x;
+        y = term.c.y;
+        len = MIN(n, term.col - x);
+        line = term.line[y];
+
+        if (sel.ob.x != -1)
+        {
+            for (i = x; i < x + len; i++)
+            {
+                if (selected(i, y))
+                {
+                    selclear();
+                    break;
+                }
+            }
+        }
+
+        /* only the ends of the run can split a wide character */
+        if (line[x].mode & ATTR_WDUMMY && x > 0 && line[x - 1].mode & ATTR_WIDE)
+        {
+            line[x - 1].u = ' ';
+            line[x - 1].mode &= ~ATTR_WIDE;
+            tsetdirtcols(y, x - 1, x);
+        }
+        if (line[x + len - 1].mode & ATTR_WIDE && x + len < term.col && line[x + len].mode & ATTR_WDUMMY)
+        {
+            line[x + len].u = ' ';
+            line[x + len].mode &= ~ATTR_WDUMMY;
+            tsetdirtcols(y, x + len, x + len + 1);
+        }
+
+        c = tcell(&term.c.attr);
+        lo = 0;
+        hi = len;
+        if (m_diffDamage && !ISDIRTY(y, x, x + len))
+        {
+            /* only the cells between the first and last change are written */
+            while (lo < hi && CELLEQ(line[x + lo], runecell(c, s[lo])))
+                lo++;
+            while (hi > lo && CELLEQ(line[x + hi - 1], runecell(c, s[hi - 1])))
+                hi--;
+            m_damageChecks += len;
+            m_damageHits += len - (hi - lo);
+        }
+        for (i = lo; i < hi; i++)
+            line[x + i] = runecell(c, s[i]);
+        if (lo < hi)
+            tsetdirtcols(y, x + lo, x + hi);
+        term.lastc = s[len - 1];
+
+        if (x + len < term.col)
+        {
+            tmoveto(x + len, y);
+        }
+        else
+        {
+            if (len > 1)
+                tmoveto(term.col - 1, y);
+            term.c.state |= CURSOR_WRAPNEXT;
+        }
+
+        s += len;
+        n -= len;
+    }
+}
+
+void TerminalEmulator::twrite(const char *buf, size_t buflen, int show_ctrl, UTF8Decoder *dec)
+{
+    Rune runes[1024];
+    size_t n, i, used, count, span, limit;
     Rune u;
-    size_t n;
 
-    for (n = 0; n < buflen; n += charsize)
+    for (n = 0; n < buflen; n += used)
     {
+        /* the escape sequence in progress may switch MODE_UTF8 */
+        if (term.esc == ESC_ESCAPE || term.esc == ESC_INTERMEDIATE || term.esc == ESC_STR_END)
+            limit = 1;
+        else
+            limit = LEN(runes);
+
         if (IS_SET(MODE_UTF8))
         {
-            /* process a complete utf8 char */
-            charsize = utf8decode(buf + n, &u, buflen - n);
-            if (charsize == 0)
-                break;
+            count = utf8decodebulk(dec, buf + n, buflen - n, runes, limit, &used);
         }
         else
         {
-            u = buf[n] & 0xFF;
-            charsize = 1;
+            for (count = 0; count < limit && n + count < buflen;)
+            {
+                u = (uchar)buf[n + count];
+                runes[count++] = u;
+                if (u == 0x1b)
+                    break;
+            }
+            used = count;
         }
-        if (show_ctrl && ISCONTROL(u))
+
+        for (i = 0; i < count; i += span)
         {
-            if (u & 0x80)
+            if (term.esc == ESC_GROUND &&
+                (term.mode & (MODE_WRAP | MODE_INSERT | MODE_PRINT)) == MODE_WRAP &&
+                term.trantbl[term.charset] != CS_GRAPHIC0 &&
+                (span = narrowspan(runes + i, count - i)) > 0)
             {
-                u &= 0x7f;
-                tputc('^');
-                tputc('[');
+                twritenarrow(runes + i, (int)span);
+                continue;
             }
-            else if (u != '\n' && u != '\r' && u != '\t')
+
+            span = 1;
+            u = runes[i];
+            if (show_ctrl && ISCONTROL(u))
             {
-                u ^= 0x40;
-                tputc('^');
+                if (u & 0x80)
+                {
+                    u &= 0x7f;
+                    tputc('^');
+                    tputc('[');
+                }
+                else if (u != '\n' && u != '\r' && u != '\t')
+                {
+                    u ^= 0x40;
+                    tputc('^');
+                }
             }
+            tputc(u);
         }
-        tputc(u);
     }
-    return (int)n;
 }
 
 void TerminalEmulator::tresize(int col, int row)
@@ -2370,47 +3522,20 @@ void TerminalEmulator::tresize(int col, int row)
         return;
     }
 
-    /*
-	 * slide screen to keep cursor where we expect it -
-	 * tscrollup would work here, but we can optimize to
-	 * memmove because we're freeing the earlier lines
-	 */
-    for (i = 0; i <= term.c.y - row; i++)
-    {
-        free(term.line[i]);
-        free(term.alt[i]);
-    }
-    /* ensure that both src and dst are not NULL */
-    if (i > 0)
-    {
-        memmove(term.line, term.line + i, row * sizeof(Line));
-        memmove(term.alt, term.alt + i, row * sizeof(Line));
-    }
-    for (i += row; i < term.row; i++)
+    term.dirty = (Damage *)xrealloc(term.dirty, row * sizeof(*term.dirty));
+    for (i = 0; i < row; i++)
     {
-        free(term.line[i]);
-        free(term.alt[i]);
+        term.dirty[i].x1 = 0;
+        term.dirty[i].x2 = col;
     }
-
-    /* resize to new height */
-    term.line = (Line *)xrealloc(term.line, row * sizeof(Line));
-    term.alt = (Line *)xrealloc(term.alt, row * sizeof(Line));
-    term.dirty = (int *)xrealloc(term.dirty, row * sizeof(*term.dirty));
     term.tabs = (int *)xrealloc(term.tabs, col * sizeof(*term.tabs));
 
-    /* resize each row to new width, zero-pad if needed */
-    for (i = 0; i < minrow; i++)
-    {
-        term.line[i] = (Line)xrealloc(term.line[i], col * sizeof(Glyph));
-        term.alt[i] = (Line)xrealloc(term.alt[i], col * sizeof(Glyph));
-    }
+    /*
+	 * slide screen to keep cursor where we expect it, the lines
+	 * slid off the main screen join its history
+	 */
+    tarena(col, row, MAX(term.c.y - row + 1, 0));
 
-    /* allocate any new rows */
-    for (/* i = minrow */; i < row; i++)
-    {
-        term.line[i] = (Line)xmalloc(col * sizeof(Glyph));
-        term.alt[i] = (Line)xmalloc(col * sizeof(Glyph));
-    }
     if (col > term.col)
     {
         bp = term.tabs + term.col;
@@ -2451,45 +3576,80 @@ void TerminalEmulator::resettitle(void)
     auto dpy = m_dpy.lock();
     if (dpy)
         dpy->SetTitle(NULL);
+    m_redraw = true;
 }
 
 void TerminalEmulator::drawregion(TerminalDisplay &dpy, int x1, int y1, int x2, int y2)
 {
-    int y;
+    Line line;
+    int y, dx1, dx2;
 
     for (y = y1; y < y2; y++)
     {
-        if (!term.dirty[y])
+        dx1 = MAX(term.dirty[y].x1, x1);
+        dx2 = MIN(term.dirty[y].x2, x2);
+        term.dirty[y].x1 = INT_MAX;
+        term.dirty[y].x2 = 0;
+        if (dx2 <= dx1)
             continue;
 
-        term.dirty[y] = 0;
+        /* never hand out half of a wide character */
+        line = TLINE(y - term.scr);
+        if (dx1 > 0 && line[dx1].mode & ATTR_WDUMMY)
+            dx1--;
+        if (dx2 < term.col && line[dx2].mode & ATTR_WDUMMY)
+            dx2++;
 
-        dpy.DrawLine(term.line[y], x1, y, x2);
+        dpy.DrawLine(line, dx1, y, dx2);
     }
 }
 
-void TerminalEmulator::draw(void)
+/* whether any row has damage that wasn't drawn yet */
+int TerminalEmulator::tisdirty(void)
+{
+    int y;
+
+    for (y = 0; y < term.row; y++)
+        if (term.dirty[y].x2 > term.dirty[y].x1)
+            return 1;
+    return 0;
+}
+
+bool TerminalEmulator::draw(bool paced)
 {
     int cx = term.c.x, ocx = term.ocx, ocy = term.ocy;
 
     {
         auto dpy = m_dpy.lock();
         if (!dpy)
-            return;
-
-        dpy->DrawBegin(term.col, term.row);
+            return false;
 
         /* adjust cursor position */
         LIMIT(term.ocx, 0, term.col - 1);
         LIMIT(term.ocy, 0, term.row - 1);
-        if (term.line[term.ocy][term.ocx].mode & ATTR_WDUMMY)
+        if (term.ocx > 0 && term.line[term.ocy][term.ocx].mode & ATTR_WDUMMY)
             term.ocx--;
-        if (term.line[term.c.y][cx].mode & ATTR_WDUMMY)
+        if (cx > 0 && term.line[term.c.y][cx].mode & ATTR_WDUMMY)
             cx--;
 
+        /* nothing changed since the last frame */
+        if (!m_redraw && cx == term.ocx && term.c.y == term.ocy && !tisdirty())
+            return false;
+        /* the display still has the last frame to show, the damage waits for the next one */
+        if (paced && !dpy->WantsFrame())
+            return false;
+
+        dpy->DrawBegin(term.col, term.row);
+        m_redraw = false;
+        m_jumpBytes = 0;
+        m_lastDraw = std::chrono::steady_clock::now();
+
+        /* screen rows are shifted when the view is scrolled back */
+        if (term.scr > 0)
+            tfulldirt();
         drawregion(*dpy, 0, 0, term.col, term.row);
-        dpy->DrawCursor(cx, term.c.y, term.line[term.c.y][cx],
-                        term.ocx, term.ocy, term.line[term.ocy][term.ocx]);
+        dpy->DrawCursor(cx, term.c.y + term.scr, GetGlyph(term.line[term.c.y][cx]),
+                        term.ocx, term.ocy, GetGlyph(term.line[term.ocy][term.ocx]));
         term.ocx = cx;
         term.ocy = term.c.y;
 
@@ -2497,6 +3657,7 @@ void TerminalEmulator::draw(void)
     }
     // if (ocx != term.ocx || ocy != term.ocy)
     //     xximspot(term.ocx, term.ocy);
+    return true;
 }
 
 void TerminalEmulator::Redraw()
@@ -2508,7 +3669,9 @@ void TerminalEmulator::Redraw()
 void TerminalEmulator::xsetmode(int set, unsigned int mode)
 {
     auto dpy = m_dpy.lock();
-    dpy->SetMode((win_mode)mode, set);
+    if (dpy)
+        dpy->SetMode((win_mode)mode, set);
+    m_redraw = true;
 }
 
 void TerminalEmulator::xsetpointermotion(int)
@@ -2524,21 +3687,50 @@ std::unique_ptr<TerminalEmulator> TerminalEmulator::Create(PtyPtr &&pty, ProcPtr
         return nullptr;
     }
 
-    return std::unique_ptr<TerminalEmulator>(new TerminalEmulator(std::move(pty), std::move(process), display));
+    int col = pty->GetNumColumns();
+    int row = pty->GetNumRows();
+
+    return std::unique_ptr<TerminalEmulator>(new TerminalEmulator(std::move(pty), std::move(process), display, col, row));
+}
+
+std::unique_ptr<TerminalEmulator> TerminalEmulator::Create(int columns, int rows, const std::shared_ptr<TerminalDisplay> &display)
+{
+    if (columns < 1 || rows < 1)
+    {
+        fprintf(stderr, "Invalid terminal size %dx%d\n", columns, rows);
+        return nullptr;
+    }
+
+    return std::unique_ptr<TerminalEmulator>(new TerminalEmulator(nullptr, nullptr, display, columns, rows));
 }
 
-TerminalEmulator::TerminalEmulator(PtyPtr &&pty, ProcPtr &&process, const std::shared_ptr<TerminalDisplay> &display)
-    : m_dpy(display), m_pty(std::move(pty)), m_process(std::move(process)), m_colorsLoaded(false), m_exitCode(1), m_status(STARTING), m_buflen(0), defaultfg(7), defaultbg(0), defaultcs(7), defaultrcs(0), allowaltscreen(1), allowwindowops(1)
+TerminalEmulator::TerminalEmulator(PtyPtr &&pty, ProcPtr &&process, const std::shared_ptr<TerminalDisplay> &display, int col, int row)
+    : m_dpy(display), m_pty(std::move(pty)), m_process(std::move(process)), m_colorsLoaded(false), m_exitCode(1), m_status(STARTING), m_reactor(nullptr), m_pool(nullptr), m_redraw(true), m_hungup(false), m_exitwatch(false), m_exitgrace(16), defaultfg(7), defaultbg(0), defaultcs(7), defaultrcs(0), allowaltscreen(1), allowwindowops(1)
 {
-    memset(m_buf, 0, sizeof(m_buf));
+    m_readsize = readsizemin;
+    m_readbatch = readbatchmin;
+    memset(&m_utf8, 0, sizeof(m_utf8));
+    m_wqueuepos = 0;
     memset(&term, 0, sizeof(term));
     memset(&sel, 0, sizeof(sel));
     memset(&csiescseq, 0, sizeof(csiescseq));
     memset(&strescseq, 0, sizeof(strescseq));
 
-    int col = m_pty->GetNumColumns();
-    int row = m_pty->GetNumRows();
-
+    m_histlines = historylines;
+    m_histbytes = historybytes;
+    m_diffDamage = diffdamage;
+    m_damageChecks = 0;
+    m_damageHits = 0;
+    m_jumpScroll = jumpscroll;
+    m_jumpDeadline = jumpscrolldeadline;
+    m_jumpBytes = 0;
+    m_skippedFrames = 0;
+#ifdef HEXE_PACKED_CELLS
+    m_styles.push_back(Style{defaultfg, defaultbg});
+    tstylerehash(64);
+    m_lastStyle = 0;
+    m_styleGcDelay = 0;
+#endif
     tnew(col, row);
     if (display)
     {
@@ -2557,7 +3749,40 @@ TerminalEmulator::~TerminalEmulator()
         if (dpy)
             dpy->Detach(this);
     }
-    m_process->Terminate();
+    if (m_reactor)
+        m_reactor->Remove(*this);
+    if (m_pool)
+        m_pool->Remove(*this);
+    if (m_reader)
+    {
+        std::unique_lock<std::mutex> lk(m_reader->lock);
+        m_reader->stop = true;
+        m_reader->space.notify_one();
+        m_reader->ready.notify_one();
+        if (m_reader->parser.joinable())
+        {
+            lk.unlock();
+            m_reader->parser.join();
+            lk.lock();
+        }
+        /* the reader may not have entered Read() yet, so keep interrupting until it is out */
+        while (!m_reader->done)
+        {
+            m_pty->Interrupt();
+            m_reader->exited.wait_for(lk, std::chrono::milliseconds(10));
+        }
+        lk.unlock();
+        m_reader->thread.join();
+    }
+    if (m_process)
+        m_process->Terminate();
+
+    free(term.arena);
+    free(term.ring);
+    free(term.altring);
+    free(term.dirty);
+    free(term.tabs);
+    free(strescseq.buf);
 }
 
 void TerminalEmulator::LogError(const char *msg)
@@ -2569,7 +3794,8 @@ void TerminalEmulator::Terminate()
 {
     if (m_status == STARTING || m_status == RUNNING)
     {
-        m_process->Terminate();
+        if (m_process)
+            m_process->Terminate();
         m_exitCode = 1;
         m_status = TERMINATED;
     }
@@ -2594,6 +3820,7 @@ void TerminalEmulator::LoadColors()
         return;
 
     dpy->ResetColors();
+    m_redraw = true;
 }
 
 int TerminalEmulator::ResetColor(int i, const char *name)
@@ -2602,22 +3829,36 @@ int TerminalEmulator::ResetColor(int i, const char *name)
     if (!dpy)
         return 0;
 
+    m_redraw = true;
     return dpy->ResetColor(i, name);
 }
 
 bool TerminalEmulator::HasExited() const
 {
-    return m_status == TERMINATED;
+    return m_status.load(std::memory_order_acquire) == TERMINATED;
 }
 
 int TerminalEmulator::GetExitCode() const
 {
-    return m_exitCode;
+    return m_exitCode.load(std::memory_order_acquire);
+}
+
+bool TerminalEmulator::Attach(PtyPtr &&pty, ProcPtr &&process)
+{
+    if (m_pty || !pty || !process)
+        return false;
+    /* it was opened at the size the emulator had when it was asked for */
+    if ((pty->GetNumColumns() != term.col || pty->GetNumRows() != term.row) && !pty->Resize(term.col, term.row))
+        return false;
+
+    m_pty = std::move(pty);
+    m_process = std::move(process);
+    return true;
 }
 
 void TerminalEmulator::Resize(int columns, int rows)
 {
-    if (!m_pty->Resize(columns, rows))
+    if (m_pty && !m_pty->Resize(columns, rows))
     {
         _die("Failed to resize pty!");
         return;
@@ -2626,33 +3867,114 @@ void TerminalEmulator::Resize(int columns, int rows)
     Redraw();
 }
 
-void TerminalEmulator::Update()
+int TerminalEmulator::Write(const char *buf, size_t buflen)
+{
+    if (!m_pty)
+        return 0;
+
+    /* input brings a scrolled back view back to the live screen */
+    SetViewOffset(0);
+    ttywriteraw(buf, buflen);
+    return (int)buflen;
+}
+
+void TerminalEmulator::SetScrollback(int lines, size_t bytes)
+{
+    m_histlines = MAX(lines, 0);
+    m_histbytes = bytes;
+    tarena(term.col, term.row, 0);
+    tfulldirt();
+}
+
+size_t TerminalEmulator::GetMemoryUsage() const
+{
+    size_t size = (size_t)term.arenacap * term.stride * sizeof(Cell) +
+                  (2 * term.ringcap + 2 * term.row) * sizeof(Line) +
+                  term.row * sizeof(*term.dirty) + term.col * sizeof(*term.tabs);
+
+#ifdef HEXE_PACKED_CELLS
+    size += m_styles.capacity() * sizeof(Style) + m_styleSlots.size() * sizeof(ushort);
+#endif
+    return size;
+}
+
+void TerminalEmulator::SetViewOffset(int offset)
+{
+    LIMIT(offset, 0, IS_SET(MODE_ALTSCREEN) ? 0 : term.histlen);
+    if (offset == term.scr)
+        return;
+
+    term.scr = offset;
+    Redraw();
+}
+
+bool TerminalEmulator::Update()
 {
+    std::unique_lock<std::mutex> lk(m_lock, std::defer_lock);
+    bool parser = m_pool || (m_reader && m_reader->parser.joinable());
+    bool drawn;
+
+    /* the parser thread draws what it parses, this only catches up on changes made from outside,
+     * and on the damage it held back while the display was busy */
+    if (parser && !lk.try_lock())
+        return false;
+
     if (m_status == TerminalEmulator::STARTING)
     {
         m_status = TerminalEmulator::RUNNING;
     }
     else if (m_status != TerminalEmulator::RUNNING)
     {
-        return;
+        return false;
     }
 
-    int n = 10;
-    while (ttyread() > 0 && n > 0)
+    /* input the child didn't read yet, it keeps reading what the child writes in the meantime */
+    if (m_pty)
+        ttyflush();
+
+    if (m_reader)
+    {
+        /* at most one ring of output per update, a flood can't hold up drawing */
+        if (!parser)
+            ttydrain(m_reader->ring.Capacity());
+    }
+    else if (m_pty && !m_reactor && !m_pool)
     {
-        --n;
+        ttyreadn();
     }
 
     // TODO: Handle blink
 
-    // TODO: Do not draw every update
-    draw();
+    /* any nb of reads since the last update make one frame, and none when nothing changed */
+    drawn = !ttyjump() && draw();
+
+    /* EIO is the hangup of an exiting shell, its exit status follows */
+    if (m_reader && m_reader->done && m_reader->error && m_reader->error != EIO && m_reader->ring.Empty())
+        _die("couldn't read from shell: %s\n", strerror(m_reader->error));
 
-    m_process->CheckExitStatus();
+    if (!m_process)
+        return drawn;
+
+    if (!m_exitwatch)
+        m_process->CheckExitStatus();
     if (m_process->HasExited())
     {
-        m_exitCode = m_process->GetExitCode();
-        m_status = TERMINATED;
-        OnProcessExit(m_exitCode);
+        /* show what the reader or the reactor still has to read first, unless something else keeps the pty open */
+        if (m_reader && !(m_reader->done && m_reader->ring.Empty()) && m_exitgrace-- > 0)
+            return drawn;
+        if ((m_reactor || m_pool) && !m_hungup && m_exitgrace-- > 0)
+            return drawn;
+        if (m_pty && !m_reader && !m_reactor && !m_pool && m_pty->GetPending() > 0 && m_exitgrace-- > 0)
+            return drawn;
+        procexit();
     }
+    return drawn;
+}
+
+/* takes the exit status of the exited process, once its output is shown */
+void TerminalEmulator::procexit()
+{
+    m_exitCode = m_process->GetExitCode();
+    m_status = TERMINATED;
+    OnProcessExit(m_exitCode);
 }
@@ -0,0 +1,241 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+#ifndef WIN32
+#include "Hexe/Terminal/TerminalReactor.h"
+#include "Hexe/Terminal/TerminalEmulator.h"
+#include "Hexe/System/IProcess.h"
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace Hexe::Terminal;
+
+/*
+ * Every pty master is in one level triggered epoll set, with the emulator
+ * as its data, next to an eventfd with no data for Wakeup(). The set only
+ * reports ptys with output, so an idle terminal is never read. A pty that
+ * hung up, or whose emulator terminated, is taken out of the set, or it
+ * would be reported forever. Ptys with queued input are watched for
+ * writing as well, until the queue is written.
+ *
+ * A process with a pidfd is in the set too, tagged with the low bit of its
+ * emulator, so its exit is an event like output, and Update() doesn't have
+ * to call waitpid() every frame. It is taken out once the status is in.
+ */
+#define EXITTAG ((uintptr_t)1)
+
+TerminalReactor::TerminalReactor(AutoHandle &&epoll, AutoHandle &&wake)
+    : m_epoll(std::move(epoll)), m_wake(std::move(wake))
+{
+}
+
+TerminalReactor::~TerminalReactor()
+{
+    for (auto t : m_terminals)
+        t->m_reactor = nullptr;
+}
+
+bool TerminalReactor::Add(TerminalEmulator &terminal)
+{
+    struct epoll_event ev = {};
+    int fd;
+
+    if (terminal.m_reactor || terminal.m_pool || terminal.m_reader || !terminal.m_pty)
+        return false;
+    if ((fd = terminal.m_pty->GetPollFd()) < 0)
+        return false;
+
+    ev.events = (uint32_t)EPOLLIN | (terminal.ttyqueued() ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.ptr = &terminal;
+    if (epoll_ctl((int)m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        perror("TerminalReactor::Add(epoll_ctl)");
+        return false;
+    }
+
+    /* without a pidfd Update() keeps polling the exit status */
+    if (terminal.m_process && (fd = terminal.m_process->GetPollFd()) >= 0)
+    {
+        ev.events = EPOLLIN;
+        ev.data.ptr = (void *)((uintptr_t)&terminal | EXITTAG);
+        if (epoll_ctl((int)m_epoll, EPOLL_CTL_ADD, fd, &ev) == 0)
+            terminal.m_exitwatch = true;
+        else
+            perror("TerminalReactor::Add(epoll_ctl)");
+    }
+
+    terminal.m_reactor = this;
+    m_terminals.push_back(&terminal);
+    return true;
+}
+
+void TerminalReactor::Remove(TerminalEmulator &terminal)
+{
+    auto it = std::find(m_terminals.begin(), m_terminals.end(), &terminal);
+    if (it == m_terminals.end())
+        return;
+
+    /* fails when it was taken out on hangup already */
+    epoll_ctl((int)m_epoll, EPOLL_CTL_DEL, terminal.m_pty->GetPollFd(), nullptr);
+    if (terminal.m_exitwatch)
+        epoll_ctl((int)m_epoll, EPOLL_CTL_DEL, terminal.m_process->GetPollFd(), nullptr);
+    terminal.m_exitwatch = false;
+    terminal.m_reactor = nullptr;
+    m_terminals.erase(it);
+}
+
+void TerminalReactor::WatchWrite(TerminalEmulator &terminal, bool watch)
+{
+    struct epoll_event ev = {};
+
+    /* a pty that hung up isn't in the set anymore */
+    if (terminal.m_hungup)
+        return;
+
+    ev.events = (uint32_t)EPOLLIN | (watch ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.ptr = &terminal;
+    if (epoll_ctl((int)m_epoll, EPOLL_CTL_MOD, terminal.m_pty->GetPollFd(), &ev) != 0)
+        perror("TerminalReactor::WatchWrite(epoll_ctl)");
+}
+
+int TerminalReactor::Dispatch(int timeout)
+{
+    struct epoll_event evs[64];
+    int i, n, nread = 0;
+    uint64_t count;
+
+    do
+        n = epoll_wait((int)m_epoll, evs, (int)(sizeof(evs) / sizeof(evs[0])), timeout);
+    while (n < 0 && errno == EINTR);
+    if (n < 0)
+    {
+        perror("TerminalReactor::Dispatch(epoll_wait)");
+        return 0;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        auto data = (uintptr_t)evs[i].data.ptr;
+        auto t = (TerminalEmulator *)(data & ~EXITTAG);
+        if (!t)
+        {
+            if (read((int)m_wake, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                perror("TerminalReactor::Dispatch(read)");
+            continue;
+        }
+
+        if (data & EXITTAG)
+        {
+            t->m_process->CheckExitStatus();
+            if (!t->m_process->HasExited())
+                continue;
+            epoll_ctl((int)m_epoll, EPOLL_CTL_DEL, t->m_process->GetPollFd(), nullptr);
+            /* otherwise the exit is taken on hangup, after the last output */
+            if (t->m_hungup && t->m_status != TerminalEmulator::TERMINATED)
+                t->procexit();
+            nread++;
+            continue;
+        }
+
+        if (evs[i].events & EPOLLOUT)
+            t->ttyflush();
+        if (evs[i].events & EPOLLIN)
+        {
+            t->ttyreadn();
+            nread++;
+        }
+        /* its output has been read to the end, the exit status comes from Update() */
+        if (t->m_status == TerminalEmulator::TERMINATED || ((evs[i].events & (EPOLLHUP | EPOLLERR)) && !(evs[i].events & EPOLLIN)))
+        {
+            epoll_ctl((int)m_epoll, EPOLL_CTL_DEL, t->m_pty->GetPollFd(), nullptr);
+            t->m_hungup = true;
+            if (t->m_exitwatch && t->m_process->HasExited() && t->m_status != TerminalEmulator::TERMINATED)
+                t->procexit();
+        }
+    }
+    return nread;
+}
+
+bool TerminalReactor::Wait(int timeout)
+{
+    struct pollfd pfd;
+    int n;
+
+    pfd.fd = (int)m_epoll;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    do
+        n = poll(&pfd, 1, timeout);
+    while (n < 0 && errno == EINTR);
+    return n > 0;
+}
+
+void TerminalReactor::Wakeup()
+{
+    uint64_t one = 1;
+    ssize_t r;
+
+    do
+        r = write((int)m_wake, &one, sizeof(one));
+    while (r < 0 && errno == EINTR);
+}
+
+int TerminalReactor::GetWakeupFd() const
+{
+    return (int)m_epoll;
+}
+
+std::unique_ptr<TerminalReactor> TerminalReactor::Create()
+{
+    struct epoll_event ev = {};
+
+    AutoHandle epoll(epoll_create1(EPOLL_CLOEXEC));
+    if (!epoll)
+    {
+        perror("TerminalReactor::Create(epoll_create1)");
+        return nullptr;
+    }
+    AutoHandle wake(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    if (!wake)
+    {
+        perror("TerminalReactor::Create(eventfd)");
+        return nullptr;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl((int)epoll, EPOLL_CTL_ADD, (int)wake, &ev) != 0)
+    {
+        perror("TerminalReactor::Create(epoll_ctl)");
+        return nullptr;
+    }
+
+    return std::unique_ptr<TerminalReactor>(new TerminalReactor(std::move(epoll), std::move(wake)));
+}
+
+#endif
@@ -0,0 +1,54 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+#ifdef WIN32
+#include "Hexe/Terminal/TerminalReactor.h"
+#include "Hexe/Terminal/TerminalEmulator.h"
+
+using namespace Hexe::Terminal;
+
+/*
+ * ConPTY pipes can't be waited on together with overlapped I/O, so there is
+ * no reactor here. Create() fails, and emulators read their own pipes.
+ */
+TerminalReactor::TerminalReactor(AutoHandle &&epoll, AutoHandle &&wake)
+    : m_epoll(std::move(epoll)), m_wake(std::move(wake))
+{
+}
+
+TerminalReactor::~TerminalReactor() {}
+
+bool TerminalReactor::Add(TerminalEmulator &terminal) { return false; }
+
+void TerminalReactor::Remove(TerminalEmulator &terminal) {}
+
+void TerminalReactor::WatchWrite(TerminalEmulator &terminal, bool watch) {}
+
+int TerminalReactor::Dispatch(int timeout) { return 0; }
+
+bool TerminalReactor::Wait(int timeout) { return false; }
+
+void TerminalReactor::Wakeup() {}
+
+int TerminalReactor::GetWakeupFd() const { return -1; }
+
+std::unique_ptr<TerminalReactor> TerminalReactor::Create() { return nullptr; }
+#endif
@@ -49,6 +49,57 @@ static unsigned int cursorshape = 2;
  */
 const unsigned int tabspaces = 8;
 
+/*
+ * scrollback history of the main screen, in lines and in bytes. The smaller
+ * of the two limits applies, a byte limit of 0 disables it.
+ */
+static int historylines = 10000;
+static size_t historybytes = 32 << 20;
+
+/*
+ * compare rewritten cells with their old contents and only report the
+ * ones that actually changed to the display
+ */
+static int diffdamage = 1;
+
+/*
+ * size of the byte ring between the pty reader thread and the parser, see
+ * TerminalEmulator::StartReader(). The reader blocks while it is full.
+ */
+static size_t readerbuffer = 1 << 20;
+
+/*
+ * nb of bytes the parser thread parses before it draws and lets go of the
+ * terminal, see TerminalEmulator::StartParser() and ParserPool
+ */
+static size_t parserbatch = 64 << 10;
+
+/*
+ * bounds of a read from the pty, when there is no reader thread. Reads grow
+ * while they come back full or the pty has more pending, and shrink while
+ * output trickles in, so floods take few syscalls and typing stays small.
+ */
+static size_t readsizemin = 4 << 10;
+static size_t readsizemax = 64 << 10;
+
+/*
+ * bounds of the bytes read per Update() or TerminalReactor::Dispatch(). The
+ * budget doubles while the output uses it up and drops back to the minimum
+ * once the pty runs dry, so a flood is parsed in few large batches. Linux
+ * ptys hand out at most a few KB per read, this is what lets a flood through.
+ */
+static size_t readbatchmin = 32 << 10;
+static size_t readbatchmax = 512 << 10;
+
+/*
+ * jump scroll: while more than jumpscroll screens of output (rows * columns
+ * bytes each) are parsed or waiting to be, the screens in between are not
+ * drawn, only the one the output ends on, and one every jumpscrolldeadline
+ * ms for as long as the flood lasts. 0 draws every screen.
+ */
+static int jumpscroll = 4;
+static unsigned int jumpscrolldeadline = 50;
+
 /* Terminal colors (16 first used in escape sequence) */
 static const char *colorname[258] = {
     // /* 8 normal colors */
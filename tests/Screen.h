@@ -0,0 +1,86 @@
+// Helpers shared by the tests: random terminal output, dumping a screen to compare it with another one,
+// and checking conditions without stopping at the first failure.
+
+#pragma once
+
+#include "Hexe/Terminal/TerminalEmulator.h"
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+
+struct Random
+{
+    uint32_t state = 0x12345678;
+
+    uint32_t Next(uint32_t range)
+    {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) % range;
+    }
+};
+
+/* a bit of everything the parser keeps state for between two Feed() calls */
+static inline std::string GenerateOutput(Random &rng, size_t bytes)
+{
+    static const char *const s_pieces[] = {
+        "plain words ", "\r\n", "\t", "\033[1;31m", "\033[38:2::200:100:50m", "\033[48;5;17m", "\033[m",
+        "\xc3\xa6\xc3\xb8\xc3\xa5", "\xe2\x94\x80\xe2\x94\x82", "\xe6\x97\xa5\xe6\x9c\xac", "\xf0\x9f\x98\x80",
+        "\033[5;7H", "\033[2K", "\033[3P", "\033[2@", "\033[4b", "\033[2;9r", "\033[r", "\033M", "\033D",
+        "\033]0;title\a", "\033]2;other\033\\", "\033P1$r\033\\", "\033(0lqk\033(B", "\033[?25l", "\033[?25h",
+        "\033[?7l", "\033[?7h", "\033[?1049h", "\033[?1049l", "\033[10X", "\033[J", "\0337", "\0338",
+    };
+    std::string out;
+
+    while (out.size() < bytes)
+        out += s_pieces[rng.Next(sizeof(s_pieces) / sizeof(s_pieces[0]))];
+    return out;
+}
+
+static int s_failures = 0;
+
+static inline void Check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "FAILED: %s\n", what);
+        s_failures++;
+    }
+}
+
+/* every cell with its attributes and colors, one row per line, and the cursor */
+static inline std::string DumpScreen(const Hexe::Terminal::TerminalEmulator &terminal)
+{
+    std::string out;
+    char buf[64];
+
+    for (int y = 0; y < terminal.GetNumRows(); y++)
+    {
+        const Hexe::Terminal::Cell *line = terminal.GetLine(y);
+        for (int x = 0; x < terminal.GetNumColumns(); x++)
+        {
+            Hexe::Terminal::Glyph g = terminal.GetGlyph(line[x]);
+            snprintf(buf, sizeof(buf), "%x/%x/%x/%x ", (unsigned)g.u, (unsigned)g.mode, (unsigned)g.fg, (unsigned)g.bg);
+            out += buf;
+        }
+        out += '\n';
+    }
+    snprintf(buf, sizeof(buf), "cursor %d,%d\n", terminal.GetCursorColumn(), terminal.GetCursorRow());
+    out += buf;
+    return out;
+}
+
+/* the characters of row y, without trailing blanks */
+static inline std::string RowText(const Hexe::Terminal::TerminalEmulator &terminal, int y)
+{
+    std::string out;
+    const Hexe::Terminal::Cell *line = terminal.GetLine(y);
+
+    for (int x = 0; x < terminal.GetNumColumns(); x++)
+    {
+        Hexe::Terminal::Rune u = terminal.GetGlyph(line[x]).u;
+        out += u >= 0x20 && u < 0x7f ? (char)u : (u ? '?' : ' ');
+    }
+    while (!out.empty() && out.back() == ' ')
+        out.pop_back();
+    return out;
+}
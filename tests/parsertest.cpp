@@ -0,0 +1,132 @@
+// Regression tests of the escape parser, run on headless terminals fed with Feed(): strings terminated
+// across control codes, SGR sub-parameters, wide characters at the start of a row, and the same output
+// fed whole, byte by byte and in random pieces, which has to leave the same screen whatever sequences
+// the pieces split.
+//
+// usage: parsertest
+
+#include "Screen.h"
+#include "Hexe/Terminal/TerminalDisplay.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+
+using namespace Hexe::Terminal;
+
+static constexpr int COLUMNS = 40;
+static constexpr int ROWS = 12;
+
+#define TRUECOLOR(r, g, b) (1u << 24 | (r) << 16 | (g) << 8 | (b))
+
+/* remembers the title and draws nothing */
+class TitleDisplay : public TerminalDisplay
+{
+public:
+    std::string title;
+
+    virtual void SetTitle(const char *t) override { title = t ? t : ""; }
+    virtual bool DrawBegin(int /*columns*/, int /*rows*/) override { return true; }
+    virtual void DrawLine(Line /*line*/, int /*x1*/, int /*y*/, int /*x2*/) override {}
+    virtual void DrawCursor(int /*cx*/, int /*cy*/, Glyph /*g*/, int /*ox*/, int /*oy*/, Glyph /*og*/) override {}
+    virtual void DrawEnd() override {}
+};
+
+static void Feed(TerminalEmulator &terminal, const char *s)
+{
+    terminal.Feed(s, strlen(s));
+}
+
+static void TestStringTerminator()
+{
+    auto display = std::make_shared<TitleDisplay>();
+    auto terminal = TerminalEmulator::Create(COLUMNS, ROWS, display);
+
+    Feed(*terminal, "\033]0;one\a");
+    Check(display->title == "one", "OSC terminated by BEL sets the title");
+
+    /* a C0 control between the ESC and the backslash of ST is executed, and the string still ends */
+    Feed(*terminal, "\033]0;two\033\n\\");
+    Check(display->title == "two", "OSC terminated by ESC LF \\ sets the title");
+    Check(terminal->GetCursorRow() == 1, "LF inside ST is executed");
+
+    /* CAN and SUB cancel the string instead */
+    Feed(*terminal, "\033]0;three\033\030\\");
+    Check(display->title == "two", "OSC cancelled by CAN inside ST leaves the title");
+}
+
+static void TestSgrSubParameters()
+{
+    auto terminal = TerminalEmulator::Create(COLUMNS, ROWS);
+
+    Feed(*terminal, "\033[38:2::10:20:30mA"
+                    "\033[38:2:0:40:50:60mB"
+                    "\033[38:2:70:80:90mC"
+                    "\033[m\033[48:5:123;1mD"
+                    "\033[m\033[38;2;1;2;3;48;5;200mE"
+                    "\033[m");
+
+    const Cell *line = terminal->GetLine(0);
+    Check(terminal->GetGlyph(line[0]).fg == TRUECOLOR(10, 20, 30), "38:2::r:g:b");
+    Check(terminal->GetGlyph(line[1]).fg == TRUECOLOR(40, 50, 60), "38:2:colorspace:r:g:b");
+    Check(terminal->GetGlyph(line[2]).fg == TRUECOLOR(70, 80, 90), "38:2:r:g:b");
+    Check(terminal->GetGlyph(line[3]).bg == 123, "48:5:index");
+    Check(terminal->GetGlyph(line[3]).mode & ATTR_BOLD, "parameter after sub-parameters");
+    Check(terminal->GetGlyph(line[4]).fg == TRUECOLOR(1, 2, 3), "38;2;r;g;b");
+    Check(terminal->GetGlyph(line[4]).bg == 200, "48;5;index after 38;2;r;g;b");
+}
+
+static void TestWideCharacterAtColumn0()
+{
+    auto terminal = TerminalEmulator::Create(10, 4);
+
+    /* DCH shifts the dummy half of the wide character into column 0, and the row above must not change */
+    Feed(*terminal, "\033[1;1HABCDEFGHIZ"
+                    "\033[2;1H\xe4\xb8\xad\033[2;1H\033[P"
+                    "\033[2;1H\xe4\xb8\xad");
+    Check(RowText(*terminal, 0) == "ABCDEFGHIZ", "writing over a dummy half in column 0 keeps the row above");
+    Check(terminal->GetGlyph(terminal->GetLine(1)[0]).u == 0x4e2d, "the wide character is written in column 0");
+}
+
+static void TestSplitSequences()
+{
+    Random rng;
+
+    for (int round = 0; round < 20; round++)
+    {
+        std::string data = GenerateOutput(rng, 4096);
+
+        auto whole = TerminalEmulator::Create(COLUMNS, ROWS);
+        whole->Feed(data.data(), data.size());
+        std::string expect = DumpScreen(*whole);
+
+        auto bytewise = TerminalEmulator::Create(COLUMNS, ROWS);
+        for (size_t i = 0; i < data.size(); i++)
+            bytewise->Feed(data.data() + i, 1);
+        Check(DumpScreen(*bytewise) == expect, "fed byte by byte");
+
+        auto pieces = TerminalEmulator::Create(COLUMNS, ROWS);
+        for (size_t i = 0, n; i < data.size(); i += n)
+        {
+            n = std::min<size_t>(1 + rng.Next(17), data.size() - i);
+            pieces->Feed(data.data() + i, n);
+        }
+        Check(DumpScreen(*pieces) == expect, "fed in random pieces");
+    }
+}
+
+int main()
+{
+    TestStringTerminator();
+    TestSgrSubParameters();
+    TestWideCharacterAtColumn0();
+    TestSplitSequences();
+
+    if (s_failures)
+    {
+        fprintf(stderr, "%d checks failed\n", s_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,183 @@
+// Regression test of ParserPool: several sessions write random output through pipes while a pool of 1 to
+// 4 workers parses them, and every screen has to end up as a headless terminal fed the same output with
+// Feed() in one piece. A session parsed out of order, or by two workers at once, leaves a different screen.
+//
+// usage: pooltest
+
+#include "Screen.h"
+#include "Hexe/Terminal/ParserPool.h"
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/ioctl.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace Hexe::Terminal;
+
+static constexpr int COLUMNS = 40;
+static constexpr int ROWS = 12;
+static constexpr int SESSIONS = 6;
+static constexpr size_t OUTPUT = 256 << 10;
+
+/* the read end of a pipe as a pseudoterminal, so the pool can wait on it */
+class PipePty : public IPseudoTerminal
+{
+private:
+    int m_fd;
+
+public:
+    explicit PipePty(int fd) : m_fd(fd) {}
+    virtual ~PipePty() { close(m_fd); }
+
+    virtual bool IsTTY() const override { return false; }
+    virtual int GetNumColumns() const override { return COLUMNS; }
+    virtual int GetNumRows() const override { return ROWS; }
+    virtual bool Resize(int /*columns*/, int /*rows*/) override { return true; }
+    /* replies to queries are dropped */
+    virtual int Write(const char * /*s*/, size_t n) override { return (int)n; }
+
+    virtual int Read(char *buf, size_t n, bool /*block*/) override
+    {
+        ssize_t r = read(m_fd, buf, n);
+        if (r < 0 && errno == EAGAIN)
+            return 0;
+        return (int)r;
+    }
+
+    virtual int GetPollFd() const override { return m_fd; }
+
+    virtual size_t GetPending() const override
+    {
+        int n = 0;
+        return ioctl(m_fd, FIONREAD, &n) == 0 ? (size_t)n : 0;
+    }
+};
+
+/* never exits, the test ends the sessions by closing their pipes */
+class IdleProcess : public Hexe::System::IProcess
+{
+public:
+    virtual void CheckExitStatus() override {}
+    virtual bool HasExited() const override { return false; }
+    virtual int GetExitCode() const override { return 0; }
+    virtual void Terminate() override {}
+    virtual void WaitForExit() override {}
+};
+
+static void WriteAll(int fd, const std::string &data)
+{
+    Random rng;
+
+    /* in pieces of random size, so reads split sequences anywhere */
+    for (size_t i = 0, n; i < data.size(); i += n)
+    {
+        n = std::min<size_t>(1 + rng.Next(8192), data.size() - i);
+        for (size_t done = 0; done < n;)
+        {
+            ssize_t r = write(fd, data.data() + i + done, n - done);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0)
+                return;
+            done += r;
+        }
+    }
+}
+
+static void TestWorkers(int workers)
+{
+    Random rng;
+    rng.state += workers;
+
+    auto pool = ParserPool::Create(workers);
+    Check(pool != nullptr, "the pool starts");
+    if (!pool)
+        return;
+
+    std::vector<std::string> outputs;
+    std::vector<std::unique_ptr<TerminalEmulator>> terminals;
+    std::vector<PipePty *> ptys;
+    std::vector<std::thread> writers;
+
+    /* the writers keep references into it */
+    outputs.reserve(SESSIONS);
+
+    for (int i = 0; i < SESSIONS; i++)
+    {
+        int fds[2];
+        if (pipe(fds) != 0)
+        {
+            Check(false, "pipe()");
+            return;
+        }
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+        outputs.push_back(GenerateOutput(rng, OUTPUT));
+        ptys.push_back(new PipePty(fds[0]));
+        terminals.push_back(TerminalEmulator::Create(std::unique_ptr<IPseudoTerminal>(ptys.back()),
+                                                     std::unique_ptr<Hexe::System::IProcess>(new IdleProcess()), nullptr));
+        Check(pool->Add(*terminals.back()), "the session is added");
+
+        int fd = fds[1];
+        const std::string &data = outputs.back();
+        writers.emplace_back([fd, &data] {
+            WriteAll(fd, data);
+            close(fd);
+        });
+    }
+    for (auto &writer : writers)
+        writer.join();
+
+    /* a batch reads and parses under the lock, so nothing left in a pipe means it was all parsed */
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    for (int i = 0; i < SESSIONS; i++)
+    {
+        for (;;)
+        {
+            {
+                std::lock_guard<std::mutex> lk(terminals[i]->GetLock());
+                if (ptys[i]->GetPending() == 0)
+                    break;
+            }
+            if (std::chrono::steady_clock::now() > deadline)
+            {
+                Check(false, "the pool parses all output within a minute");
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        pool->Remove(*terminals[i]);
+    }
+
+    for (int i = 0; i < SESSIONS; i++)
+    {
+        auto serial = TerminalEmulator::Create(COLUMNS, ROWS);
+        serial->Feed(outputs[i].data(), outputs[i].size());
+
+        std::lock_guard<std::mutex> lk(terminals[i]->GetLock());
+        if (DumpScreen(*terminals[i]) != DumpScreen(*serial))
+        {
+            fprintf(stderr, "%d workers, session %d:\n", workers, i);
+            Check(false, "the pool leaves the same screen as a serial run");
+        }
+    }
+}
+
+int main()
+{
+    for (int workers = 1; workers <= 4; workers++)
+        TestWorkers(workers);
+
+    if (s_failures)
+    {
+        fprintf(stderr, "%d checks failed\n", s_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Regression test of the scrollback byte limit: a headless terminal with a full history is resized through
+// a sequence of widths and heights, and its history limit lowered, and the memory it reports has to stay
+// within the limit plus what its two screens take. Narrowing the window keeps the lines as wide as they
+// were, which the limit has to count.
+//
+// usage: scrollbacktest
+
+#include "Screen.h"
+#include <memory>
+#include <string>
+
+using namespace Hexe::Terminal;
+
+static constexpr size_t BUDGET = 4 << 20;
+
+/* both screens and their rings, with lines up to twice as wide as the window */
+static size_t ScreenBytes(int columns, int rows)
+{
+    auto terminal = TerminalEmulator::Create(2 * columns, rows);
+    terminal->SetScrollback(0, 0);
+    return terminal->GetMemoryUsage();
+}
+
+/* scrolls enough lines through the screen to fill any history the limit allows */
+static void FillHistory(TerminalEmulator &terminal)
+{
+    std::string line(terminal.GetNumColumns() - 1, 'x');
+    std::string out;
+
+    line += "\r\n";
+    for (size_t i = 0; i < BUDGET / (terminal.GetNumColumns() * sizeof(Cell)) + terminal.GetNumRows(); i++)
+        out += line;
+    terminal.Feed(out.data(), out.size());
+}
+
+static void CheckUsage(TerminalEmulator &terminal, size_t budget)
+{
+    size_t usage = terminal.GetMemoryUsage();
+    size_t limit = budget + ScreenBytes(terminal.GetNumColumns(), terminal.GetNumRows());
+
+    if (usage > limit)
+    {
+        fprintf(stderr, "%dx%d: %zu bytes, limit %zu\n", terminal.GetNumColumns(), terminal.GetNumRows(), usage,
+                limit);
+        Check(false, "the history stays within its byte limit");
+    }
+}
+
+static void TestResize()
+{
+    static const int s_sizes[][2] = {
+        {200, 50}, {101, 50}, {200, 50}, {150, 30}, {76, 30}, {101, 60}, {51, 60}, {40, 20}, {79, 20}, {200, 50},
+    };
+    auto terminal = TerminalEmulator::Create(s_sizes[0][0], s_sizes[0][1]);
+
+    terminal->SetScrollback(1 << 20, BUDGET);
+    for (auto &size : s_sizes)
+    {
+        terminal->Resize(size[0], size[1]);
+        CheckUsage(*terminal, BUDGET);
+        FillHistory(*terminal);
+        CheckUsage(*terminal, BUDGET);
+        Check(terminal->GetMemoryUsage() > BUDGET / 2, "the history fills up to its byte limit");
+    }
+
+    /* the arena kept for reuse must not outlast a lower limit */
+    terminal->Resize(101, 50);
+    terminal->SetScrollback(1 << 20, BUDGET * 3 / 5);
+    FillHistory(*terminal);
+    CheckUsage(*terminal, BUDGET * 3 / 5);
+    Check(terminal->GetMemoryUsage() > BUDGET * 3 / 10, "the history fills up to its lower byte limit");
+}
+
+int main()
+{
+    TestResize();
+
+    if (s_failures)
+    {
+        fprintf(stderr, "%d checks failed\n", s_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,188 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2020 Fredrik A. Kristiansen
+
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+
+// Generates src/runeprops.h, a two stage lookup table with the display width,
+// emoji, box drawing and control properties of every rune.
+//
+// The properties are derived from src/wide.h, src/nonspacing.h,
+// src/emoji_blocks.h and src/boxdraw_data.h. To move to a new Unicode
+// version, regenerate those (tools/gen-emoji-headers.py for the emoji
+// bitmaps) and then build the runeprops target, which runs this program
+// over src/runeprops.h. Nothing in src/config.def.h goes into the table,
+// so the word delimiters stay a runtime setting.
+//
+// usage: gen-runeprops <output file>
+
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "boxdraw_data.h"
+#include "emoji_blocks.h"
+
+static const unsigned char table[] = {
+#include "nonspacing.h"
+};
+
+static const unsigned char wtable[] = {
+#include "wide.h"
+};
+
+static constexpr uint32_t RUNE_MAX = 0x110000;
+static constexpr int BLOCK_SHIFT = 7;
+static constexpr uint32_t BLOCK_SIZE = 1u << BLOCK_SHIFT;
+
+enum
+{
+    RUNE_WIDTH = 3,
+    RUNE_EMOJI = 1 << 2,
+    RUNE_BOXDRAW = 1 << 3,
+    RUNE_CONTROL = 1 << 4,
+};
+
+static bool IsEmoji(uint32_t code)
+{
+    for (const emoji_range_t **curr = emoji_ranges; *curr != 0; ++curr)
+    {
+        if ((int32_t)code >= (*curr)->min_code && (int32_t)code <= (*curr)->max_code)
+        {
+            uint32_t ofs = code - (*curr)->min_code;
+            return ((*curr)->bitmap[ofs / 8] >> (ofs % 8)) & 1;
+        }
+    }
+    return false;
+}
+
+/* wcwidth() as the emulator used to compute it, -1 for non-printable */
+static int Width(uint32_t wc)
+{
+    if (wc < 0xffU)
+        return ((wc + 1) & 0x7f) >= 0x21 ? 1 : wc ? -1 : 0;
+
+    if (IsEmoji(wc))
+        return 2;
+
+    if ((wc & 0xfffeffffU) < 0xfffe)
+    {
+        if ((table[table[wc >> 8] * 32 + ((wc & 255) >> 3)] >> (wc & 7)) & 1)
+            return 0;
+        if ((wtable[wtable[wc >> 8] * 32 + ((wc & 255) >> 3)] >> (wc & 7)) & 1)
+            return 2;
+        return 1;
+    }
+
+    if ((wc & 0xfffe) == 0xfffe)
+        return -1;
+    if (wc - 0x20000U < 0x20000)
+        return 2;
+    if (wc == 0xe0001 || wc - 0xe0020U < 0x5f || wc - 0xe0100 < 0xef)
+        return 0;
+
+    return 1;
+}
+
+static bool IsBoxdraw(uint32_t u)
+{
+    uint32_t block = u & ~0xff;
+    return (block == 0x2500 && boxdata[u & 0xff]) || block == 0x2800;
+}
+
+static uint8_t Properties(uint32_t u)
+{
+    int width = Width(u);
+    uint8_t props = width < 0 ? 0 : width;
+
+    if (IsEmoji(u))
+        props |= RUNE_EMOJI;
+    if (IsBoxdraw(u))
+        props |= RUNE_BOXDRAW;
+    if (u < 0x20 || (u >= 0x7f && u < 0xa0))
+        props |= RUNE_CONTROL;
+    return props;
+}
+
+static void WriteArray(FILE *out, const char *type, const char *name, const std::vector<unsigned> &values)
+{
+    fprintf(out, "static constexpr %s %s[%zu] = {", type, name, values.size());
+    for (size_t i = 0; i < values.size(); i++)
+        fprintf(out, "%s%u,", i % 16 ? " " : "\n    ", values[i]);
+    fprintf(out, "\n};\n\n");
+}
+
+int main(int argc, char **argv)
+{
+    std::map<std::vector<unsigned>, unsigned> blocks;
+    std::vector<unsigned> index, data;
+    FILE *out;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <output file>\n", argv[0]);
+        return 1;
+    }
+
+    for (uint32_t base = 0; base < RUNE_MAX; base += BLOCK_SIZE)
+    {
+        std::vector<unsigned> block(BLOCK_SIZE);
+        for (uint32_t i = 0; i < BLOCK_SIZE; i++)
+            block[i] = Properties(base + i);
+
+        auto found = blocks.find(block);
+        if (found == blocks.end())
+        {
+            found = blocks.emplace(block, (unsigned)blocks.size()).first;
+            data.insert(data.end(), block.begin(), block.end());
+        }
+        index.push_back(found->second);
+    }
+
+    if ((out = fopen(argv[1], "w")) == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    fprintf(out, "/* Generated by tools/gen-runeprops.cpp, do not edit. */\n\n");
+    fprintf(out, "/* rune properties, see runeprops() */\n");
+    fprintf(out, "enum rune_property\n{\n");
+    fprintf(out, "    RUNE_WIDTH = %d,    /* columns taken: 0, 1 or 2 */\n", RUNE_WIDTH);
+    fprintf(out, "    RUNE_EMOJI = %d,    /* emoji presentation */\n", RUNE_EMOJI);
+    fprintf(out, "    RUNE_BOXDRAW = %d,  /* drawn by the box drawing code */\n", RUNE_BOXDRAW);
+    fprintf(out, "    RUNE_CONTROL = %d, /* C0 or C1 control */\n", RUNE_CONTROL);
+    fprintf(out, "};\n\n");
+    fprintf(out, "#define RUNEPROPS_SHIFT %d\n\n", BLOCK_SHIFT);
+    WriteArray(out, blocks.size() <= 256 ? "unsigned char" : "unsigned short", "runeprops_index", index);
+    WriteArray(out, "unsigned char", "runeprops_data", data);
+    fprintf(out, "/* properties of u, in a single table lookup */\n");
+    fprintf(out, "static inline unsigned char\nruneprops(uint32_t u)\n{\n");
+    fprintf(out, "    if (u >= 0x%X)\n", RUNE_MAX);
+    fprintf(out, "        return 1;\n");
+    fprintf(out, "    return runeprops_data[runeprops_index[u >> RUNEPROPS_SHIFT] << RUNEPROPS_SHIFT |\n");
+    fprintf(out, "                          (u & ((1 << RUNEPROPS_SHIFT) - 1))];\n");
+    fprintf(out, "}\n");
+    fclose(out);
+
+    fprintf(stderr, "%zu blocks, %zu bytes of index and %zu bytes of data\n",
+            blocks.size(), index.size() * (blocks.size() <= 256 ? 1 : 2), data.size());
+    return 0;
+}